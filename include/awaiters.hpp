@@ -1,3 +1,6 @@
+#ifndef _CORO_AWAITERS_H_
+#define _CORO_AWAITERS_H_
+
 #include <coroutine>
 #include <atomic>
 #include <queue>
@@ -23,44 +26,227 @@ namespace coro {
 		}
 	};
 
+	namespace details {
+		// Waiter embedded in an awaiter and linked into the list of the primitive it waits for.
+		struct wait_node {
+			wait_node* next = nullptr;
+			wait_node* prev = nullptr;
+			coroutine_handle handle = nullptr;
+			// left by the cancellation, which took the node out of the list
+			bool cancelled = false;
+			// set by select(), which takes the wakeup over; plain waiters are resumed with go(handle)
+			void (*notify)(wait_node* self) = nullptr;
+
+			// Called by the primitive once the wait is over.
+			void wake() {
+				if (notify != nullptr)
+					notify(this);
+				else
+					go(handle);
+			}
+		};
+
+		// FIFO of wait_nodes, guarded by the lock of its owner.
+		struct wait_list {
+			wait_node head;
+
+			wait_list() {
+				head.next = head.prev = &head;
+			}
+
+			wait_list(const wait_list&) = delete;
+			wait_list& operator=(const wait_list&) = delete;
+
+			bool empty() const {
+				return head.next == &head;
+			}
+
+			void push_front(wait_node* node) {
+				node->next = head.next;
+				node->prev = &head;
+				head.next->prev = node;
+				head.next = node;
+			}
+
+			void push_back(wait_node* node) {
+				node->next = &head;
+				node->prev = head.prev;
+				head.prev->next = node;
+				head.prev = node;
+			}
+
+			wait_node* pop_front() {
+				if (empty())
+					return nullptr;
+				wait_node* node = head.next;
+				remove(node);
+				return node;
+			}
+
+			void remove(wait_node* node) {
+				node->prev->next = node->next;
+				node->next->prev = node->prev;
+				node->next = node->prev = nullptr;
+			}
+
+			// Moves every node of other to the back of this list.
+			void splice_back(wait_list& other) {
+				if (other.empty())
+					return;
+				other.head.next->prev = head.prev;
+				head.prev->next = other.head.next;
+				other.head.prev->next = &head;
+				head.prev = other.head.prev;
+				other.head.next = other.head.prev = &other.head;
+			}
+
+			// only meaningful for nodes that are in no other list
+			static bool linked(const wait_node* node) {
+				return node->next != nullptr;
+			}
+		};
+
+		// Collects the woken nodes of a primitive so their tasks reach the scheduler in one
+		// go(span) call. Nodes with a notify hook are woken right away.
+		struct wake_batch {
+			static constexpr size_t capacity = 64;
+
+			coroutine_handle handles[capacity];
+			size_t count = 0;
+
+			wake_batch() = default;
+			wake_batch(const wake_batch&) = delete;
+			wake_batch& operator=(const wake_batch&) = delete;
+
+			~wake_batch() {
+				flush();
+			}
+
+			void add(wait_node* node) {
+				if (node->notify != nullptr) {
+					node->notify(node);
+					return;
+				}
+				handles[count++] = node->handle;
+				if (count == capacity)
+					flush();
+			}
+
+			void flush() {
+				if (count == 0)
+					return;
+				go(std::span<coroutine_handle>(handles, count));
+				count = 0;
+			}
+		};
+	}
+
+	enum class mutex_mode {
+		// unlock() hands the lock to the first waiter, waiters get it in FIFO order
+		handoff,
+		// unlock() releases the lock and wakes the first waiter, which retries right
+		// before it runs; coroutines that are running meanwhile may take the lock first
+		barging,
+	};
+
+	/*
+	The whole lock is one word: `locked`, `queued` (waiters is not empty) and
+	`queue_locked`, set by whoever edits the intrusive list of waiters for the
+	few instructions that takes. Taking a free lock and releasing one nobody
+	waits for are a single CAS each.
+	*/
 	struct mutex {
 	private:
-		spin_lock waiters_lock;
-		std::atomic_flag flag;
-		std::queue<std::coroutine_handle<task2::promise_type>> waiters;
+		static constexpr uintptr_t locked = 1;
+		static constexpr uintptr_t queued = 2;
+		static constexpr uintptr_t queue_locked = 4;
+
+		std::atomic<uintptr_t> state = 0;
+		details::wait_list waiters;
+		const mutex_mode mode;
+
+		// Sets queue_locked, returns the state before.
+		uintptr_t lock_queue() {
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (true) {
+				if (s & queue_locked) {
+					std::this_thread::yield();
+					s = state.load(std::memory_order_relaxed);
+				}
+				else if (state.compare_exchange_weak(s, s | queue_locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+					return s;
+				}
+			}
+		}
 	public:
 
-		mutex() {
-			flag.clear();
-		}
+		explicit mutex(mutex_mode mode = mutex_mode::handoff) : mode(mode) {}
 
-		struct mutex_lock_awaiter {
+		// co_await lock() returns false, without the lock, when the task got cancelled while waiting
+		struct mutex_lock_awaiter : details::wait_node, resume_guard {
 			mutex& m;
+			// set before on_cancel() looks for the node, for a barging waiter that is between two attempts
+			std::atomic<bool> cancel_requested = false;
+			details::cancel_registration<mutex_lock_awaiter> cancel;
 
 			mutex_lock_awaiter(mutex& m) : m(m) {}
 
 			bool await_ready() {
-				//If the flag is not set, then we can try to steal this flag to get the lock
-				return !m.flag.test_and_set(std::memory_order_acquire);
-			}
-
-			bool await_suspend(std::coroutine_handle<task2::promise_type> h) {
-				std::lock_guard<spin_lock> lg(m.waiters_lock);
-				// we need to check again 
-				if (m.flag.test_and_set(std::memory_order_acquire)) {
-					// If we still don't acquire the lock, 
-					// then add the current coroutine to the wait queue
-					park(h);
-					m.waiters.push(h);
-					return true;
+				return m.try_lock();
+			}
+
+			bool await_suspend(root_handle h) {
+				handle = h;
+				if (m.mode == mutex_mode::barging) {
+					notify = &mutex_lock_awaiter::on_released;
+					routine = &mutex_lock_awaiter::retry;
+				}
+				if (!m.enqueue(this)) {
+					// If we successfully acquire the lock, 
+					// we don't have to do anything
+					return false;
+				}
+				cancel.watch(h.promise().cancel_token, this);
+				return true;
+			}
 
+			// barging: popped by unlock() without the lock, the worker calls retry() before it resumes the task
+			static void on_released(details::wait_node* self) {
+				auto* a = static_cast<mutex_lock_awaiter*>(self);
+				a->handle.promise().guard = a;
+				go(a->handle);
+			}
+
+			static bool retry(resume_guard* self, coroutine_handle h) {
+				auto* a = static_cast<mutex_lock_awaiter*>(self);
+				h.promise().guard = nullptr;
+				if (a->cancel_requested.load()) {
+					a->cancelled = true;
+					a->m.pass_on();
+					return true;
+				}
+				// someone barged in, wait at the front again
+				if (!a->m.enqueue(a, true))
+					return true;
+				if (a->cancel_requested.load() && a->m.unlink(a)) {
+					a->cancelled = true;
+					a->m.pass_on();
+					// parked by enqueue(), so it has to go through the scheduler once more
+					go(h);
 				}
-				// If we successfully acquire the lock, 
-				// we don't have to do anything
 				return false;
 			}
 
-			void await_resume() {
+			void on_cancel() {
+				cancel_requested.store(true);
+				if (!m.unlink(this))
+					return;
+				cancelled = true;
+				go(handle);
+			}
+
+			bool await_resume() {
+				return !cancelled;
 			}
 		};
 
@@ -69,21 +255,112 @@ namespace coro {
 			return mutex_lock_awaiter(*this);
 		}
 
-		void unlock() {
-			waiters_lock.lock();
-			if (!waiters.empty()) {
-				// one of the suspended coroutines can acquire this lock
-				auto h = waiters.front();
-				waiters.pop();
-				//let h re-enter the scheduler for scheduling
-				go(h);
+		bool try_lock() {
+			// a single lock bts; setting the bit again when it is already set changes nothing
+			return !(state.fetch_or(locked, std::memory_order_acquire) & locked);
+		}
+
+		// Takes the lock, or parks node->handle and queues it. Returns false if the lock was taken.
+		bool enqueue(details::wait_node* node, bool front = false) {
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (true) {
+				if (!(s & locked)) {
+					if (state.compare_exchange_weak(s, s | locked, std::memory_order_acquire, std::memory_order_relaxed))
+						return false;
+				}
+				else if (s & queue_locked) {
+					std::this_thread::yield();
+					s = state.load(std::memory_order_relaxed);
+				}
+				// queued goes up together with the queue lock, so an unlock() from now on waits for the node
+				else if (state.compare_exchange_weak(s, s | queued | queue_locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			park(node->handle, "mutex");
+			if (front)
+				waiters.push_front(node);
+			else
+				waiters.push_back(node);
+			// While the queue is locked and so is the mutex, everyone else waits for the queue or,
+			// in try_lock(), sets a bit that is set already. A plain store cannot lose anything.
+			state.store(s | queued, std::memory_order_release);
+			return true;
+		}
+
+		// enqueue() for every node of nodes under one lock of the queue; the nodes are parked already.
+		// Returns the node that took the lock, if it was free, for the caller to wake.
+		details::wait_node* enqueue_all(details::wait_list& nodes) {
+			details::wait_node* owner = nullptr;
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (!nodes.empty()) {
+				if (!(s & locked)) {
+					if (state.compare_exchange_weak(s, s | locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+						owner = nodes.pop_front();
+						s |= locked;
+					}
+				}
+				else if (s & queue_locked) {
+					std::this_thread::yield();
+					s = state.load(std::memory_order_relaxed);
+				}
+				else if (state.compare_exchange_weak(s, s | queued | queue_locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+					waiters.splice_back(nodes);
+					// see enqueue()
+					state.store(s | queued, std::memory_order_release);
+				}
+			}
+			return owner;
+		}
 
-				//flag should not be cleared because h has been woken up and h is set to the owner of the lock 
+		// Takes a queued node out again. Returns false if unlock() got to it first.
+		bool unlink(details::wait_node* node) {
+			lock_queue();
+			bool linked = details::wait_list::linked(node);
+			uintptr_t clear = queue_locked;
+			if (linked) {
+				waiters.remove(node);
+				if (waiters.empty())
+					clear |= queued;
 			}
-			else {
-				flag.clear(std::memory_order::release);
+			state.fetch_and(~clear, std::memory_order_release);
+			return linked;
+		}
+
+		void unlock() {
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			if (s == locked && state.compare_exchange_strong(s, 0, std::memory_order_release, std::memory_order_relaxed))
+				return;
+			while (true) {
+				if (!(s & queued)) {
+					if (state.compare_exchange_weak(s, s & ~locked, std::memory_order_release, std::memory_order_relaxed))
+						return;
+				}
+				else if (s & queue_locked) {
+					std::this_thread::yield();
+					s = state.load(std::memory_order_relaxed);
+				}
+				else if (state.compare_exchange_weak(s, s | queue_locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+					break;
+				}
 			}
-			waiters_lock.unlock();
+			details::wait_node* node = waiters.pop_front();
+			uintptr_t clear = queue_locked;
+			if (waiters.empty())
+				clear |= queued;
+			// a barging waiter takes the lock itself, anyone else is handed the lock, which stays set for them
+			if (node->notify == &mutex_lock_awaiter::on_released)
+				clear |= locked;
+			// see enqueue() for why a store will do
+			state.store(s & ~clear, std::memory_order_release);
+			node->wake();
+		}
+
+	private:
+		// A barging waiter gave up: wakes the next one in case the lock is free with nobody on the way to it.
+		void pass_on() {
+			if (try_lock())
+				unlock();
 		}
 	};
 
@@ -91,32 +368,54 @@ namespace coro {
 
 	struct condition_variable {
 		spin_lock slock;
+		details::wait_list waiters;
 
-		struct waiter_info {
-			coroutine_handle handle;
-			mutex& mtx;
-		};
-		std::queue<waiter_info> waiters;
-
-		struct condition_variable_waiter {
+		/*
+		co_await wait(mtx) returns with mtx locked again either way, and false
+		when the task got cancelled before it was notified.
+		*/
+		struct condition_variable_waiter : details::wait_node {
 			condition_variable& cv;
 			mutex& mtx;
+			// in cv.waiters, guarded by cv.slock. The node moves on to the list of mtx after that
+			bool waiting = false;
+			details::cancel_registration<condition_variable_waiter> cancel;
+
 			condition_variable_waiter(condition_variable& cv, mutex& mtx) : cv(cv), mtx(mtx) {}
 
 			bool await_ready() {
 				return false;
 			}
 
-			bool await_suspend(coroutine_handle h) {
-				std::lock_guard<spin_lock> lg(cv.slock);
-
-				cv.waiters.push({ h, mtx });
-				park(h);
-				mtx.unlock();
+			bool await_suspend(root_handle h) {
+				handle = h;
+				{
+					std::lock_guard<spin_lock> lg(cv.slock);
+					cv.waiters.push_back(this);
+					waiting = true;
+					park(h, "condition_variable");
+					mtx.unlock();
+				}
+				cancel.watch(h.promise().cancel_token, this);
 				return true;
 			}
 
-			void await_resume() { }
+			void on_cancel() {
+				{
+					std::lock_guard<spin_lock> lg(cv.slock);
+					if (!waiting)
+						return;
+					cv.waiters.remove(this);
+					waiting = false;
+					cancelled = true;
+				}
+				// the mutex is not given up on, the waiter queues for it like a notified one
+				wakeup(this);
+			}
+
+			bool await_resume() {
+				return !cancelled;
+			}
 		};
 
 
@@ -126,26 +425,44 @@ namespace coro {
 
 		void notify_one() {
 			std::lock_guard<spin_lock> lg(slock);
-			if (!waiters.empty()) {
-				auto h = waiters.front();
-				waiters.pop();
-				wakeup(h);
+			if (auto w = pop()) {
+				wakeup(w);
 			}
 		}
 
+		// Wait morphing: the waiters move over to the queue of the mutex in one go rather
+		// than being woken only to block on it again. Only the one that gets the lock runs.
 		void notify_all() {
-			std::lock_guard<spin_lock> lg(slock);
-			while (!waiters.empty()) {
-				auto h = waiters.front();
-				waiters.pop();
-				wakeup(h);
+			details::wait_list notified;
+			mutex* mtx = nullptr;
+			{
+				std::lock_guard<spin_lock> lg(slock);
+				while (auto w = pop()) {
+					// waiters on another mutex than the first one keep the slow way
+					if (mtx != nullptr && &w->mtx != mtx) {
+						wakeup(w);
+						continue;
+					}
+					mtx = &w->mtx;
+					notified.push_back(w);
+				}
+			}
+			if (mtx != nullptr) {
+				if (auto owner = mtx->enqueue_all(notified))
+					owner->wake();
 			}
 		}
 
-		void wakeup(waiter_info& w) {
-			auto mutex_awaiter = w.mtx.lock();
-			if (!mutex_awaiter.await_suspend(w.handle)) {
-				go(w.handle);
+		condition_variable_waiter* pop() {
+			auto w = static_cast<condition_variable_waiter*>(waiters.pop_front());
+			if (w != nullptr)
+				w->waiting = false;
+			return w;
+		}
+
+		static void wakeup(condition_variable_waiter* w) {
+			if (!w->mtx.enqueue(w)) {
+				w->wake();
 			}
 		}
 	};
@@ -154,7 +471,7 @@ namespace coro {
 		std::atomic<int> expect_count;
 
 		spin_lock lock;
-		std::queue<coroutine_handle> waiters;
+		details::wait_list waiters;
 
 		wait_group(int n = 0) : expect_count(n) {}
 
@@ -163,37 +480,352 @@ namespace coro {
 		}
 
 		void done() {
-			int old_count = expect_count.fetch_sub(1);
-			if (old_count == 1) {
-				std::lock_guard<spin_lock> lg(lock);
-				while (!waiters.empty()) {
-					auto h = waiters.front();
-					waiters.pop();
-					go(h);
-				}
+			int count = expect_count.load(std::memory_order_relaxed);
+			while (count > 1) {
+				if (expect_count.compare_exchange_weak(count, count - 1))
+					return;
+			}
+			details::wake_batch batch;
+			std::lock_guard<spin_lock> lg(lock);
+			// the count reaches zero under the lock, so whoever sees zero can wait for us to let go of the group
+			if (expect_count.fetch_sub(1) != 1)
+				return;
+			while (auto node = waiters.pop_front()) {
+				batch.add(node);
 			}
 		}
 
-		struct wg_awaiter {
+		// True once the count is zero and done() is through with the group, which may be destroyed then.
+		bool finished() {
+			if (expect_count.load() != 0)
+				return false;
+			std::lock_guard<spin_lock> lg(lock);
+			return true;
+		}
+
+		// co_await wait() returns false when the task got cancelled before the count reached zero
+		struct wg_awaiter : details::wait_node {
 			wait_group& wg;
+			details::cancel_registration<wg_awaiter> cancel;
 
 			wg_awaiter(wait_group& wg) : wg(wg) {}
 
 			bool await_ready() {
-				return wg.expect_count == 0;
+				return wg.finished();
+			}
+
+			bool await_suspend(root_handle h) {
+				handle = h;
+				{
+					std::lock_guard<spin_lock> lg(wg.lock);
+					// the last done() drops the count under the lock, so it either sees us or we see zero
+					if (wg.expect_count == 0)
+						return false;
+					wg.waiters.push_back(this);
+					park(h, "wait_group");
+				}
+				cancel.watch(h.promise().cancel_token, this);
+				return true;
 			}
 
-			void await_suspend(coroutine_handle h) {
-				std::lock_guard<spin_lock> lg(wg.lock);
-				wg.waiters.push(h);
-				park(h);
+			void on_cancel() {
+				{
+					std::lock_guard<spin_lock> lg(wg.lock);
+					if (!details::wait_list::linked(this))
+						return;
+					wg.waiters.remove(this);
+					cancelled = true;
+				}
+				go(handle);
 			}
 
-			void await_resume() {}
+			bool await_resume() {
+				return !cancelled;
+			}
 		};
 
 		wg_awaiter wait() {
 			return wg_awaiter(*this);
 		}
 	};
-}
\ No newline at end of file
+
+	enum class shared_mutex_mode {
+		// a writer that unlocks lets in every reader that queued meanwhile as one batch, then the next writer
+		batched,
+		// queued writers go first, readers only get in once no writer waits
+		writer_preferring,
+	};
+
+	/*
+	Readers-writer lock. The state word holds the writer bit, the `pending` bit
+	(someone is queued) and the number of readers, so readers and writers get in
+	with a single CAS while nobody waits. Everything else happens under
+	queue_lock, which guards the two intrusive queues. Once a writer waits, new
+	readers queue too, so writers are not starved by a stream of readers.
+	*/
+	struct shared_mutex {
+		static constexpr uintptr_t writer = 1;
+		static constexpr uintptr_t pending = 2;
+		static constexpr uintptr_t one_reader = 4;
+
+		std::atomic<uintptr_t> state = 0;
+		spin_lock queue_lock;
+		details::wait_list readers;
+		details::wait_list writers;
+		const shared_mutex_mode mode;
+
+		explicit shared_mutex(shared_mutex_mode mode = shared_mutex_mode::batched) : mode(mode) {}
+
+		// co_await lock() and lock_shared() return false, without the lock, when the task got cancelled while waiting
+		struct lock_awaiter : details::wait_node {
+			shared_mutex& m;
+			bool shared;
+			details::cancel_registration<lock_awaiter> cancel;
+
+			lock_awaiter(shared_mutex& m, bool shared) : m(m), shared(shared) {}
+
+			bool await_ready() {
+				return shared ? m.try_lock_shared() : m.try_lock();
+			}
+
+			bool await_suspend(root_handle h) {
+				handle = h;
+				if (!m.enqueue(this))
+					return false;
+				cancel.watch(h.promise().cancel_token, this);
+				return true;
+			}
+
+			void on_cancel() {
+				{
+					std::lock_guard<spin_lock> lg(m.queue_lock);
+					if (!details::wait_list::linked(this))
+						return;
+					(shared ? m.readers : m.writers).remove(this);
+					cancelled = true;
+					// the readers queued behind a writer may get in now
+					m.grant_locked(false);
+				}
+				go(handle);
+			}
+
+			bool await_resume() {
+				return !cancelled;
+			}
+		};
+
+		lock_awaiter lock() {
+			return lock_awaiter(*this, false);
+		}
+
+		lock_awaiter lock_shared() {
+			return lock_awaiter(*this, true);
+		}
+
+		bool try_lock() {
+			uintptr_t s = 0;
+			return state.compare_exchange_strong(s, writer, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		bool try_lock_shared() {
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (!(s & (writer | pending))) {
+				if (state.compare_exchange_weak(s, s + one_reader, std::memory_order_acquire, std::memory_order_relaxed))
+					return true;
+			}
+			return false;
+		}
+
+		void unlock() {
+			uintptr_t s = writer;
+			if (state.compare_exchange_strong(s, 0, std::memory_order_release, std::memory_order_relaxed))
+				return;
+			std::lock_guard<spin_lock> lg(queue_lock);
+			state.fetch_and(~writer, std::memory_order_release);
+			grant_locked(true);
+		}
+
+		void unlock_shared() {
+			uintptr_t prev = state.fetch_sub(one_reader, std::memory_order_release);
+			// the last reader out lets the writer in
+			if ((prev & pending) && prev / one_reader == 1) {
+				std::lock_guard<spin_lock> lg(queue_lock);
+				grant_locked(false);
+			}
+		}
+
+		// Takes the lock, or parks a->handle and queues it. Returns false if the lock was taken.
+		bool enqueue(lock_awaiter* a) {
+			std::lock_guard<spin_lock> lg(queue_lock);
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (true) {
+				// queued readers always wait behind a queued writer, so an empty writer queue is all it takes
+				bool free = writers.empty() && (a->shared ? !(s & writer) : (s & ~pending) == 0);
+				if (free) {
+					if (state.compare_exchange_weak(s, s + (a->shared ? one_reader : writer), std::memory_order_acquire, std::memory_order_relaxed))
+						return false;
+				}
+				else if (state.compare_exchange_weak(s, s | pending, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			park(a->handle, a->shared ? "shared_mutex (shared)" : "shared_mutex");
+			(a->shared ? readers : writers).push_back(a);
+			return true;
+		}
+
+		// Lets in whoever may go next, with queue_lock held. after_writer tells a writer just left.
+		void grant_locked(bool after_writer) {
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			if (s & writer)
+				return;
+			bool readers_first = after_writer && mode == shared_mutex_mode::batched;
+			if (!readers.empty() && (readers_first || writers.empty())) {
+				size_t count = 0;
+				for (auto* n = readers.head.next; n != &readers.head; n = n->next)
+					count++;
+				update_locked(count * one_reader, !writers.empty());
+				details::wake_batch batch;
+				while (auto node = readers.pop_front()) {
+					batch.add(node);
+				}
+			}
+			else if (!writers.empty() && s / one_reader == 0) {
+				auto node = writers.pop_front();
+				update_locked(writer, !readers.empty() || !writers.empty());
+				node->wake();
+			}
+			else if (readers.empty() && writers.empty()) {
+				update_locked(0, false);
+			}
+		}
+
+		// Adds `taken` to the state and sets pending to whether anyone stays queued.
+		void update_locked(uintptr_t taken, bool queued) {
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (!state.compare_exchange_weak(s, ((s & ~pending) + taken) | (queued ? pending : 0), std::memory_order_acq_rel, std::memory_order_relaxed)) {
+			}
+		}
+	};
+
+	/*
+	Counting semaphore. Waiters are served in FIFO order, so one large acquire(n)
+	is not starved by a stream of small ones: while anyone waits, acquirers queue
+	behind it. The state word holds the available count and the `pending` bit,
+	the queue is guarded by queue_lock.
+	*/
+	struct semaphore {
+		static constexpr uintptr_t pending = 1;
+		static constexpr uintptr_t one = 2;
+
+		std::atomic<uintptr_t> state;
+		spin_lock queue_lock;
+		details::wait_list waiters;
+
+		explicit semaphore(size_t count = 0) : state(count * one) {}
+
+		// co_await acquire(n) returns false, without taking anything, when the task got cancelled while waiting
+		struct acquire_awaiter : details::wait_node {
+			semaphore& sem;
+			size_t count;
+			details::cancel_registration<acquire_awaiter> cancel;
+
+			acquire_awaiter(semaphore& sem, size_t count) : sem(sem), count(count) {}
+
+			bool await_ready() {
+				return sem.try_acquire(count);
+			}
+
+			bool await_suspend(root_handle h) {
+				handle = h;
+				if (!sem.enqueue(this))
+					return false;
+				cancel.watch(h.promise().cancel_token, this);
+				return true;
+			}
+
+			void on_cancel() {
+				{
+					std::lock_guard<spin_lock> lg(sem.queue_lock);
+					if (!details::wait_list::linked(this))
+						return;
+					sem.waiters.remove(this);
+					cancelled = true;
+					// the ones behind may fit in what is there
+					sem.grant_locked();
+				}
+				go(handle);
+			}
+
+			bool await_resume() {
+				return !cancelled;
+			}
+		};
+
+		acquire_awaiter acquire(size_t count = 1) {
+			return acquire_awaiter(*this, count);
+		}
+
+		bool try_acquire(size_t count = 1) {
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (!(s & pending) && s / one >= count) {
+				if (state.compare_exchange_weak(s, s - count * one, std::memory_order_acquire, std::memory_order_relaxed))
+					return true;
+			}
+			return false;
+		}
+
+		void release(size_t count = 1) {
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (!(s & pending)) {
+				if (state.compare_exchange_weak(s, s + count * one, std::memory_order_release, std::memory_order_relaxed))
+					return;
+			}
+			std::lock_guard<spin_lock> lg(queue_lock);
+			state.fetch_add(count * one, std::memory_order_release);
+			grant_locked();
+		}
+
+		size_t available() const {
+			return state.load(std::memory_order_relaxed) / one;
+		}
+
+		// Takes count, or parks a->handle and queues it. Returns false if count was taken.
+		bool enqueue(acquire_awaiter* a) {
+			std::lock_guard<spin_lock> lg(queue_lock);
+			uintptr_t s = state.load(std::memory_order_relaxed);
+			while (true) {
+				if (waiters.empty() && s / one >= a->count) {
+					if (state.compare_exchange_weak(s, s - a->count * one, std::memory_order_acquire, std::memory_order_relaxed))
+						return false;
+				}
+				else if (state.compare_exchange_weak(s, s | pending, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			park(a->handle, "semaphore");
+			waiters.push_back(a);
+			return true;
+		}
+
+		// Serves the queue from the front as far as the count goes, with queue_lock held.
+		// While pending is set nobody else changes the state.
+		void grant_locked() {
+			details::wake_batch batch;
+			while (!waiters.empty()) {
+				auto* head = static_cast<acquire_awaiter*>(waiters.head.next);
+				if (available() < head->count)
+					return;
+				waiters.pop_front();
+				uintptr_t taken = head->count * one;
+				if (waiters.empty())
+					taken |= pending;
+				state.fetch_sub(taken, std::memory_order_acquire);
+				batch.add(head);
+			}
+			state.fetch_and(~pending, std::memory_order_relaxed);
+		}
+	};
+}
+
+#endif
\ No newline at end of file
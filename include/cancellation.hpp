@@ -0,0 +1,77 @@
+#ifndef _CORO_CANCELLATION_H_
+#define _CORO_CANCELLATION_H_
+
+#include <stop_token>
+#include <optional>
+
+namespace coro {
+
+	/*
+	Cooperative cancellation. A task carries a cancellation_token, which tasks it
+	spawns with go() inherit unless they were given one of their own. Once the
+	source is cancelled, the awaiters of this library that are suspended on behalf
+	of such a task resume with a cancelled status (see each awaiter), and the ones
+	started afterwards may still complete as usual; nothing is interrupted halfway.
+	*/
+	struct cancellation_token {
+		std::stop_token stop;
+
+		cancellation_token() = default;
+		cancellation_token(std::stop_token stop) : stop(std::move(stop)) {}
+
+		// false for the default token, which is never cancelled
+		bool cancellable() const noexcept {
+			return stop.stop_possible();
+		}
+
+		bool cancelled() const noexcept {
+			return stop.stop_requested();
+		}
+	};
+
+	struct cancellation_source {
+		std::stop_source source;
+
+		cancellation_token token() const noexcept {
+			return { source.get_token() };
+		}
+
+		// Returns false if it was cancelled before.
+		bool cancel() noexcept {
+			return source.request_stop();
+		}
+
+		bool cancelled() const noexcept {
+			return source.stop_requested();
+		}
+	};
+
+	namespace details {
+		/*
+		Calls owner->on_cancel() when the token is cancelled, from the thread that
+		cancels it, for as long as the registration lives. Destroying it waits for a
+		running on_cancel() to return, so an awaiter that embeds one stays valid
+		until then.
+		*/
+		template<typename _Owner>
+		struct cancel_registration {
+			struct invoke {
+				_Owner* owner;
+
+				void operator()() const noexcept {
+					owner->on_cancel();
+				}
+			};
+
+			std::optional<std::stop_callback<invoke>> callback;
+
+			// on_cancel() runs right here when the token is already cancelled
+			void watch(const cancellation_token& token, _Owner* owner) {
+				if (token.cancellable())
+					callback.emplace(token.stop, invoke{ owner });
+			}
+		};
+	}
+}
+
+#endif
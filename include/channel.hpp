@@ -0,0 +1,477 @@
+#ifndef _CORO_CHANNEL_H_
+#define _CORO_CHANNEL_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <new>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+#include "scheduler.hpp"
+#include "awaiters.hpp"
+
+namespace coro {
+
+	/*
+	Multi-producer multi-consumer channel.
+
+	A bounded channel keeps its values in a lock-free ring of `capacity` cells:
+	send and recv only touch the ring and two counters as long as nobody has to
+	wait. Coroutines that do wait are parked in the awaiter itself, on lists
+	guarded by a spin lock, and a value is handed straight to a parked receiver
+	rather than going through the ring. Senders are served in order: while some
+	are parked, a new one queues behind them even if the ring has room. A
+	capacity of 0 makes every send wait for a receiver.
+	An unbounded channel never makes senders wait; its values are queued under
+	the spin lock.
+
+	After close(), sends fail and receivers get the values still queued, then
+	nothing. Awaiters of a cancelled task give up like on close().
+	*/
+	template<typename T>
+	class channel {
+		struct cell {
+			std::atomic<size_t> seq;
+			alignas(T) unsigned char storage[sizeof(T)];
+
+			T* get() {
+				return std::launder(reinterpret_cast<T*>(storage));
+			}
+		};
+
+		struct waiter : details::wait_node {
+			// what a sender sends, or what a receiver was given
+			std::optional<T> value;
+			// set by whoever took the value of a parked sender
+			bool done = false;
+			// woken by close()
+			bool closed = false;
+		};
+
+		enum class result { done, closed, blocked };
+
+	public:
+		static constexpr size_t unbounded = SIZE_MAX;
+
+		explicit channel(size_t capacity = unbounded) : capacity(capacity) {
+			if (bounded() && capacity > 0) {
+				cells.reset(new cell[capacity]);
+				for (size_t i = 0; i < capacity; i++)
+					cells[i].seq.store(2 * i, std::memory_order_relaxed);
+			}
+		}
+
+		channel(const channel&) = delete;
+		channel& operator=(const channel&) = delete;
+
+		~channel() {
+			std::optional<T> value;
+			while (pop_item(value))
+				value.reset();
+		}
+
+		// Fails if the channel is full or closed, value is not moved from then.
+		template<typename U>
+		bool try_send(U&& value) {
+			if (is_closed.load(std::memory_order_acquire))
+				return false;
+			if (bounded() && capacity > 0 && waiting_receivers.load() == 0 && waiting_senders.load() == 0) {
+				if (push_ring(std::forward<U>(value))) {
+					after_push();
+					return true;
+				}
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (waiting_receivers.load(std::memory_order_relaxed) == 0)
+					return false;
+			}
+			std::lock_guard<spin_lock> lg(lock);
+			return send_locked(std::forward<U>(value)) == result::done;
+		}
+
+		// Empty if there is nothing to take right now.
+		std::optional<T> try_recv() {
+			std::optional<T> value;
+			if (bounded() && capacity > 0) {
+				if (pop_ring(value)) {
+					after_pop();
+					return value;
+				}
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (waiting_senders.load(std::memory_order_relaxed) == 0)
+					return value;
+			}
+			std::lock_guard<spin_lock> lg(lock);
+			recv_locked(value);
+			return value;
+		}
+
+		// Takes up to max values that are there right now, returns how many.
+		size_t try_recv_many(T* out, size_t max) {
+			size_t n = 0;
+			std::optional<T> value;
+			while (n < max) {
+				value = try_recv();
+				if (!value)
+					break;
+				out[n++] = std::move(*value);
+			}
+			return n;
+		}
+
+		// Wakes every waiter; the values already queued can still be received.
+		void close() {
+			details::wake_batch batch;
+			std::lock_guard<spin_lock> lg(lock);
+			if (is_closed.exchange(true))
+				return;
+			while (auto w = pop_waiter(receivers, waiting_receivers)) {
+				w->closed = true;
+				batch.add(w);
+			}
+			while (auto w = pop_waiter(senders, waiting_senders)) {
+				w->closed = true;
+				batch.add(w);
+			}
+		}
+
+		bool closed() const {
+			return is_closed.load(std::memory_order_acquire);
+		}
+
+		// co_await returns false if the value could not be sent, because the channel
+		// was closed or the task got cancelled.
+		struct send_awaiter : waiter {
+			channel& ch;
+			bool sent = false;
+			details::cancel_registration<send_awaiter> cancel;
+
+			template<typename U>
+			send_awaiter(channel& ch, U&& value) : ch(ch) {
+				this->value.emplace(std::forward<U>(value));
+			}
+
+			bool await_ready() {
+				if (!ch.bounded() || ch.capacity == 0 || ch.waiting_receivers.load() != 0 || ch.waiting_senders.load() != 0)
+					return false;
+				if (ch.is_closed.load(std::memory_order_acquire))
+					return true;
+				sent = ch.push_ring(std::move(*this->value));
+				if (sent)
+					ch.after_push();
+				return sent;
+			}
+
+			bool await_suspend(root_handle h) {
+				this->handle = h;
+				{
+					std::lock_guard<spin_lock> lg(ch.lock);
+					// counted before trying once more, see after_pop()
+					ch.waiting_senders.fetch_add(1);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					result r = ch.send_locked(std::move(*this->value));
+					if (r != result::blocked) {
+						ch.waiting_senders.fetch_sub(1);
+						sent = r == result::done;
+						return false;
+					}
+					park(h, "channel send");
+					ch.senders.push_back(this);
+				}
+				cancel.watch(h.promise().cancel_token, this);
+				return true;
+			}
+
+			void on_cancel() {
+				if (ch.withdraw(ch.senders, ch.waiting_senders, this))
+					go(this->handle);
+			}
+
+			bool await_resume() {
+				return sent || this->done;
+			}
+		};
+
+		// co_await returns the value, or nothing once the channel is closed and
+		// drained or the task got cancelled.
+		struct recv_awaiter : waiter {
+			channel& ch;
+			details::cancel_registration<recv_awaiter> cancel;
+
+			recv_awaiter(channel& ch) : ch(ch) {}
+
+			bool await_ready() {
+				if (!ch.bounded() || ch.capacity == 0)
+					return false;
+				if (ch.pop_ring(this->value)) {
+					ch.after_pop();
+					return true;
+				}
+				return false;
+			}
+
+			bool await_suspend(root_handle h) {
+				this->handle = h;
+				{
+					std::lock_guard<spin_lock> lg(ch.lock);
+					// counted before trying once more, see after_push()
+					ch.waiting_receivers.fetch_add(1);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (ch.recv_locked(this->value) != result::blocked) {
+						ch.waiting_receivers.fetch_sub(1);
+						return false;
+					}
+					park(h, "channel recv");
+					ch.receivers.push_back(this);
+				}
+				cancel.watch(h.promise().cancel_token, this);
+				return true;
+			}
+
+			void on_cancel() {
+				if (ch.withdraw(ch.receivers, ch.waiting_receivers, this))
+					go(this->handle);
+			}
+
+			std::optional<T> await_resume() {
+				return std::move(this->value);
+			}
+		};
+
+		// co_await waits for at least one value and returns how many were stored to out,
+		// 0 once the channel is closed and drained or the task got cancelled.
+		struct recv_many_awaiter : recv_awaiter {
+			T* out;
+			size_t max;
+			size_t count = 0;
+
+			recv_many_awaiter(channel& ch, T* out, size_t max) : recv_awaiter(ch), out(out), max(max) {}
+
+			bool await_ready() {
+				count = max == 0 ? 0 : this->ch.try_recv_many(out, max);
+				return count > 0 || max == 0;
+			}
+
+			size_t await_resume() {
+				if (count > 0 || !this->value)
+					return count;
+				out[0] = std::move(*this->value);
+				return 1 + this->ch.try_recv_many(out + 1, max - 1);
+			}
+		};
+
+		template<typename U>
+		send_awaiter send(U&& value) {
+			return send_awaiter(*this, std::forward<U>(value));
+		}
+
+		recv_awaiter recv() {
+			return recv_awaiter(*this);
+		}
+
+		recv_many_awaiter recv_many(T* out, size_t max) {
+			return recv_many_awaiter(*this, out, max);
+		}
+
+	private:
+		bool bounded() const {
+			return capacity != unbounded;
+		}
+
+		// Vyukov's bounded queue: a cell is free for the push at pos when its seq is
+		// 2 * pos, and holds the value of that push once its seq is 2 * pos + 1.
+		// Counting in steps of two keeps a single cell apart from its next lap.
+		template<typename U>
+		bool push_ring(U&& value) {
+			size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+			cell* c;
+			while (true) {
+				c = &cells[pos % capacity];
+				size_t seq = c->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)(2 * pos);
+				if (diff == 0) {
+					if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0) {
+					return false;
+				}
+				else {
+					pos = enqueue_pos.load(std::memory_order_relaxed);
+				}
+			}
+			new (c->storage) T(std::forward<U>(value));
+			c->seq.store(2 * pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool pop_ring(std::optional<T>& value) {
+			size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+			cell* c;
+			while (true) {
+				c = &cells[pos % capacity];
+				size_t seq = c->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)(2 * pos + 1);
+				if (diff == 0) {
+					if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0) {
+					return false;
+				}
+				else {
+					pos = dequeue_pos.load(std::memory_order_relaxed);
+				}
+			}
+			T* v = c->get();
+			value.emplace(std::move(*v));
+			v->~T();
+			c->seq.store(2 * (pos + capacity), std::memory_order_release);
+			return true;
+		}
+
+		// The queue of either mode. The deque of an unbounded channel needs the lock.
+		template<typename U>
+		bool push_item(U&& value) {
+			if (!bounded()) {
+				queue.emplace_back(std::forward<U>(value));
+				return true;
+			}
+			return capacity > 0 && push_ring(std::forward<U>(value));
+		}
+
+		bool pop_item(std::optional<T>& value) {
+			if (!bounded()) {
+				if (queue.empty())
+					return false;
+				value.emplace(std::move(queue.front()));
+				queue.pop_front();
+				return true;
+			}
+			return capacity > 0 && pop_ring(value);
+		}
+
+		// Nothing is queued, not even by a push that has not finished yet: a value taken
+		// from the ring may seem to be the first one while an older one is still being written.
+		bool drained() const {
+			if (!bounded())
+				return queue.empty();
+			return enqueue_pos.load() == dequeue_pos.load();
+		}
+
+		// A receiver parks after it counted itself and found the ring empty, a sender
+		// looks for receivers after it filled a cell: one of them sees the other.
+		void after_push() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiting_receivers.load(std::memory_order_relaxed) == 0)
+				return;
+			std::lock_guard<spin_lock> lg(lock);
+			feed_receivers_locked();
+		}
+
+		void after_pop() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiting_senders.load(std::memory_order_relaxed) == 0)
+				return;
+			std::lock_guard<spin_lock> lg(lock);
+			feed_senders_locked();
+		}
+
+		waiter* pop_waiter(details::wait_list& list, std::atomic<size_t>& count) {
+			auto w = static_cast<waiter*>(list.pop_front());
+			if (w != nullptr)
+				count.fetch_sub(1);
+			return w;
+		}
+
+		bool withdraw(details::wait_list& list, std::atomic<size_t>& count, waiter* w) {
+			std::lock_guard<spin_lock> lg(lock);
+			if (!details::wait_list::linked(w))
+				return false;
+			list.remove(w);
+			count.fetch_sub(1);
+			w->cancelled = true;
+			return true;
+		}
+
+		// Queued values go to parked receivers first, in order.
+		void feed_receivers_locked() {
+			while (!receivers.empty()) {
+				std::optional<T> value;
+				if (!pop_item(value))
+					return;
+				auto w = pop_waiter(receivers, waiting_receivers);
+				w->value = std::move(value);
+				go(w->handle);
+			}
+		}
+
+		// Values of parked senders move into the room receivers left.
+		void feed_senders_locked() {
+			while (!senders.empty()) {
+				auto w = static_cast<waiter*>(senders.head.next);
+				if (!push_item(std::move(*w->value)))
+					return;
+				pop_waiter(senders, waiting_senders);
+				w->done = true;
+				go(w->handle);
+			}
+		}
+
+		template<typename U>
+		result send_locked(U&& value) {
+			if (is_closed.load(std::memory_order_relaxed))
+				return result::closed;
+			// parked senders are older than value and get the room first
+			feed_senders_locked();
+			if (!senders.empty())
+				return result::blocked;
+			// so is whatever is queued
+			feed_receivers_locked();
+			if (!receivers.empty() && drained()) {
+				auto w = pop_waiter(receivers, waiting_receivers);
+				w->value.emplace(std::forward<U>(value));
+				go(w->handle);
+				return result::done;
+			}
+			if (!push_item(std::forward<U>(value)))
+				return result::blocked;
+			feed_receivers_locked();
+			return result::done;
+		}
+
+		result recv_locked(std::optional<T>& value) {
+			if (pop_item(value)) {
+				feed_senders_locked();
+				return result::done;
+			}
+			// nothing queued, a parked sender hands its value over directly
+			if (drained()) {
+				if (auto w = pop_waiter(senders, waiting_senders)) {
+					value = std::move(w->value);
+					w->done = true;
+					go(w->handle);
+					return result::done;
+				}
+			}
+			return is_closed.load(std::memory_order_relaxed) ? result::closed : result::blocked;
+		}
+
+		const size_t capacity;
+		std::unique_ptr<cell[]> cells;
+		alignas(64) std::atomic<size_t> enqueue_pos = 0;
+		alignas(64) std::atomic<size_t> dequeue_pos = 0;
+
+		alignas(64) spin_lock lock;
+		std::atomic<bool> is_closed = false;
+		// sizes of the lists below, read without the lock
+		std::atomic<size_t> waiting_senders = 0;
+		std::atomic<size_t> waiting_receivers = 0;
+		details::wait_list senders;
+		details::wait_list receivers;
+		// the values of an unbounded channel
+		std::deque<T> queue;
+	};
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef _CORO_FRAME_POOL_H_
+#define _CORO_FRAME_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <new>
+
+namespace coro {
+
+	/*
+	Coroutine frames of the task types are taken from per-thread free lists,
+	one list per 64 byte size class. A frame goes back to the lists of the thread
+	that destroys it, which is usually the worker that ran it to completion.
+	Frames larger than the biggest class go straight to the global allocator.
+
+	Define CORO_FRAME_POOL_STATS (cmake -DLIBCORO_FRAME_POOL_STATS=ON) to count hits
+	and read them with frame_pool_snapshot(). It changes the layout of the per-thread
+	cache, so it has to be defined for the whole build.
+	*/
+	struct frame_pool_stats {
+		uint64_t allocations = 0;
+		// allocations served from a free list
+		uint64_t hits = 0;
+		uint64_t deallocations = 0;
+		// deallocations kept in a free list
+		uint64_t recycled = 0;
+
+		double hit_rate() const {
+			return allocations == 0 ? 0.0 : (double)hits / (double)allocations;
+		}
+	};
+
+	namespace details {
+		struct frame_cache {
+			static constexpr size_t granularity = 64;
+			static constexpr size_t class_count = 32;
+			// blocks kept per class, anything above goes back to the global allocator
+			static constexpr size_t max_cached = 256;
+
+			struct free_block {
+				free_block* next;
+			};
+
+			free_block* lists[class_count] = {};
+			uint32_t counts[class_count] = {};
+			bool destroyed = false;
+
+#ifdef CORO_FRAME_POOL_STATS
+			struct counters {
+				std::atomic<uint64_t> allocations = 0;
+				std::atomic<uint64_t> hits = 0;
+				std::atomic<uint64_t> deallocations = 0;
+				std::atomic<uint64_t> recycled = 0;
+
+				// only the owning thread writes, so no read-modify-write is needed
+				static void bump(std::atomic<uint64_t>& v) {
+					v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				}
+			} stats;
+
+			frame_cache* next_cache = nullptr;
+			frame_cache* prev_cache = nullptr;
+
+			frame_cache();
+#endif
+			~frame_cache();
+
+			static size_t size_class(size_t size) {
+				return (size + granularity - 1) / granularity - 1;
+			}
+
+			void* allocate(size_t size) {
+				size_t c = size_class(size);
+#ifdef CORO_FRAME_POOL_STATS
+				counters::bump(stats.allocations);
+#endif
+				if (c < class_count && lists[c] != nullptr) {
+					free_block* block = lists[c];
+					lists[c] = block->next;
+					counts[c]--;
+#ifdef CORO_FRAME_POOL_STATS
+					counters::bump(stats.hits);
+#endif
+					return block;
+				}
+				// round up so the block can serve any frame of its class later
+				return ::operator new(c < class_count ? (c + 1) * granularity : size);
+			}
+
+			void deallocate(void* p, size_t size) {
+				size_t c = size_class(size);
+#ifdef CORO_FRAME_POOL_STATS
+				counters::bump(stats.deallocations);
+#endif
+				if (c < class_count && counts[c] < max_cached) {
+					free_block* block = static_cast<free_block*>(p);
+					block->next = lists[c];
+					lists[c] = block;
+					counts[c]++;
+#ifdef CORO_FRAME_POOL_STATS
+					counters::bump(stats.recycled);
+#endif
+					return;
+				}
+				::operator delete(p);
+			}
+		};
+
+		inline thread_local frame_cache tls_frame_cache;
+	}
+
+	inline void* allocate_frame(size_t size) {
+		auto& cache = details::tls_frame_cache;
+		// frames created while the thread is being torn down bypass the pool
+		if (cache.destroyed)
+			return ::operator new(size);
+		return cache.allocate(size);
+	}
+
+	inline void deallocate_frame(void* p, size_t size) {
+		auto& cache = details::tls_frame_cache;
+		if (cache.destroyed) {
+			::operator delete(p);
+			return;
+		}
+		cache.deallocate(p, size);
+	}
+
+#ifdef CORO_FRAME_POOL_STATS
+	// sums the counters of all live threads and of the threads that already exited
+	frame_pool_stats frame_pool_snapshot();
+#endif
+}
+
+#endif
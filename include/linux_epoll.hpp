@@ -6,89 +6,483 @@
 #else
 
 #include "scheduler.hpp"
+#include "timer.hpp"
+#include "log.hpp"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <functional>
+#include <atomic>
+#include <chrono>
 
 namespace coro::linux_epoll {
 
-    using epoll_routine = std::function<void(uint32_t, int)>;
-
-    struct epoll_callback_info {
-        epoll_routine routine;
-        std::string routine_name;
+    /*
+    Base of every awaiter that waits for an fd. The awaiter itself is what gets
+    parked in the registration, and the reactor calls back through a plain
+    function pointer, so suspending costs no allocation.
+    */
+    struct epoll_operation {
+        void (*routine)(epoll_operation* self, uint32_t event, int err) = nullptr;
     };
 
+    // routine of an _Obj derived from epoll_operation, forwards to its on_event()
     template<typename _Obj>
-    void epoll_routine_t(uint32_t event, int err, void* context) {
-        (*reinterpret_cast<_Obj*>(context))(event, err);
-    }
-
-    template<typename _Cb>
-    void init_epoll_cb(epoll_callback_info* ep, const char* name, _Cb&& cb) {
-        ep->routine = cb;
-        ep->routine_name = name;
+    void epoll_routine_t(epoll_operation* self, uint32_t event, int err) {
+        static_cast<_Obj*>(self)->on_event(event, err);
     }
     
+    /*
+    Per-fd state. The fd is added to epoll once, edge triggered for both
+    directions, and stays there until close_socket().
+    Each direction is a slot that holds either `idle`, `ready` (an edge arrived
+    and nobody consumed it yet) or the epoll_operation of the one coroutine
+    waiting on it. A second coroutine waiting in the same direction fails with
+    EBUSY. `closed` is left by unregister() until the fd is registered again,
+    operations that still get there fail with EBADF.
+    `idle` doubles as the readiness hint: the last attempt hit EAGAIN and no edge
+    came since, so awaiters skip the speculative syscall and park right away.
+    */
+    enum class io_attempt {
+        // EAGAIN, wait for the next edge
+        blocked,
+        // completed, the fd may still have more
+        done,
+        // completed with a short read or write, so the fd was drained by this very call
+        drained,
+    };
+
+    struct epoll_registration {
+        static constexpr uintptr_t idle = 0;
+        static constexpr uintptr_t ready = 1;
+        static constexpr uintptr_t closed = 2;
+
+        std::atomic<bool> registered = false;
+        std::atomic<uintptr_t> reader = idle;
+        std::atomic<uintptr_t> writer = idle;
+
+        // Consumes a pending edge and runs try_op. Returns true if try_op completed,
+        // false right away if the hint says idle.
+        // The slot is cleared before the syscall, so an edge raised while it runs is kept.
+        template<typename _Op>
+        bool try_ready(std::atomic<uintptr_t>& slot, _Op&& try_op) {
+            uintptr_t state = slot.load(std::memory_order_acquire);
+            while (state == ready) {
+                if (!slot.compare_exchange_weak(state, idle, std::memory_order_acq_rel))
+                    continue;
+                io_attempt result = try_op();
+                if (result == io_attempt::drained)
+                    return true;
+                if (result == io_attempt::done) {
+                    // one edge can stand for several connections or reads
+                    uintptr_t expected = idle;
+                    slot.compare_exchange_strong(expected, ready, std::memory_order_acq_rel);
+                    return true;
+                }
+                state = slot.load(std::memory_order_acquire);
+            }
+            return false;
+        }
+
+        // Runs try_op whenever the direction may be ready and parks op otherwise.
+        // Returns true if op was parked. Otherwise error is 0 if try_op completed,
+        // EBUSY if another operation is parked in the slot, or EBADF once it is closed.
+        template<typename _Op>
+        bool arm(std::atomic<uintptr_t>& slot, epoll_operation* op, _Op&& try_op, int& error) {
+            error = 0;
+            while (true) {
+                if (try_ready(slot, try_op))
+                    return false;
+                uintptr_t expected = idle;
+                if (slot.compare_exchange_strong(expected, (uintptr_t)op, std::memory_order_acq_rel))
+                    return true;
+                if (expected != ready) {
+                    error = expected == closed ? EBADF : EBUSY;
+                    return false;
+                }
+            }
+        }
+
+        void wake(std::atomic<uintptr_t>& slot, uint32_t event, int err) {
+            uintptr_t prev = slot.load(std::memory_order_acquire);
+            do {
+                // an event still in flight for an fd that was unregistered
+                if (prev == closed)
+                    return;
+            } while (!slot.compare_exchange_weak(prev, ready, std::memory_order_acq_rel));
+            if (prev != idle && prev != ready) {
+                epoll_operation* op = (epoll_operation*)prev;
+                op->routine(op, event, err);
+            }
+        }
+
+        // Closes the slot for good and resumes whoever is parked in it with EBADF.
+        void close(std::atomic<uintptr_t>& slot) {
+            uintptr_t prev = slot.exchange(closed, std::memory_order_acq_rel);
+            if (prev != idle && prev != ready && prev != closed) {
+                epoll_operation* op = (epoll_operation*)prev;
+                op->routine(op, EPOLLERR, EBADF);
+            }
+        }
+
+        void on_event(uint32_t event) {
+            if (event & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                wake(reader, event, 0);
+            if (event & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+                wake(writer, event, 0);
+        }
+    };
+
+    // How long a reactor keeps polling before it blocks in epoll_wait; 0, the default, blocks
+    // right away. Polling keeps a core busy per reactor and saves the wakeup of the thread.
+    void set_epoll_busy_poll(std::chrono::microseconds window);
+    std::chrono::microseconds epoll_busy_poll();
+
+    /*
+    One epoll instance and the thread blocked on it. Coroutines woken by its
+    events are queued to the worker paired with it (see set_home_worker()), so
+    the coroutines of a socket keep running on the same worker.
+    The reactor also drives the timers of that worker: epoll_wait sleeps until
+    the next one is due, and an eventfd cuts the sleep short when an earlier
+    timer is added.
+    */
     struct epoll_awaiter : coro::thread_awaiter {
+        // bounds of the event array, which doubles when one epoll_wait fills it
+        // and halves after shrink_turns in a row that used less than a quarter
+        static constexpr size_t min_events = 64;
+        static constexpr size_t max_events = 1024;
+        static constexpr unsigned shrink_turns = 64;
+
         int fd_epoll = 0;
-        
-        epoll_awaiter() {
+        int fd_wake = -1;
+        size_t index;
+        details::timer_wheel timers;
+        std::vector<epoll_event> events = std::vector<epoll_event>(min_events);
+        unsigned sparse_turns = 0;
+
+        epoll_awaiter(size_t index) : index(index) {
             fd_epoll = epoll_create(8);
+            fd_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            // null tells the wakeup apart from the registrations
+            ev.data.ptr = nullptr;
+            epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_wake, &ev);
         }
 
-        virtual void wait(std::vector<coroutine_handle>& handles) {
-            struct epoll_event events[10];
-            int ret = epoll_wait(fd_epoll, events, 10, -1);
-            if(ret <= 0) {
-                printf("epoll_wait failed! %d\r\n", errno);
-                fflush(stdout);
-                return;
+        // Polls for the busy poll window (cut to the next timer), then blocks.
+        int poll() {
+            int ret = 0;
+            int timeout = timers.timeout();
+            auto window = epoll_busy_poll();
+            if (timeout != 0 && window.count() > 0) {
+                if (timeout > 0)
+                    window = std::min<std::chrono::microseconds>(window, std::chrono::milliseconds(timeout));
+                auto until = std::chrono::steady_clock::now() + window;
+                do {
+                    ret = epoll_wait(fd_epoll, events.data(), (int)events.size(), 0);
+                } while (ret == 0 && std::chrono::steady_clock::now() < until);
+                if (ret != 0)
+                    return ret;
+                timeout = timers.timeout();
+            }
+            return epoll_wait(fd_epoll, events.data(), (int)events.size(), timeout);
+        }
+
+        void resize(int ret) {
+            if ((size_t)ret == events.size() && events.size() < max_events) {
+                events.resize(events.size() * 2);
+                sparse_turns = 0;
+            }
+            else if ((size_t)ret < events.size() / 4 && events.size() > min_events) {
+                if (++sparse_turns == shrink_turns) {
+                    events.resize(events.size() / 2);
+                    events.shrink_to_fit();
+                    sparse_turns = 0;
+                }
+            }
+            else {
+                sparse_turns = 0;
             }
+        }
 
-            for(int i = 0 ; i < ret; i++) {
-                epoll_callback_info* c = (epoll_callback_info*)events[i].data.ptr;
-                printf("epoll calling %s\n", c->routine_name.c_str());
-                if(c->routine != nullptr) {
-                    c->routine(events[i].events, errno);
+        virtual void wait(std::vector<coroutine_handle>& handles) {
+            // the awaiter may be picked up by a different thread each time
+            coro::set_home_worker(index);
+
+            int ret = poll();
+            int err = errno;
+            // everything woken by this turn goes to the scheduler in one batch
+            coro::collect_wakeups(&handles);
+            timers.expire();
+            metrics::details::count(metrics::event::reactor_wakeup);
+            if(ret < 0) {
+                if(err != EINTR)
+                    CORO_LOG(error, "epoll_wait failed: %d", err);
+            }
+            else {
+                metrics::details::record(metrics::series::reactor_batch, (uint64_t)ret);
+                for(int i = 0 ; i < ret; i++) {
+                    epoll_registration* r = (epoll_registration*)events[i].data.ptr;
+                    if(r == nullptr) {
+                        uint64_t value;
+                        while(::read(fd_wake, &value, sizeof(value)) > 0);
+                        continue;
+                    }
+                    r->on_event(events[i].events);
                 }
+                resize(ret);
             }
+            coro::collect_wakeups(nullptr);
+        }
+
+        void add_timer(details::timer_node* node) {
+            if(timers.add(node))
+                wake();
+        }
+
+        void wake() {
+            uint64_t one = 1;
+            ssize_t n = ::write(fd_wake, &one, sizeof(one));
+            (void)n;
         }
 
 		virtual bool should_suspend() const override {
             return false;
         }
 
-        virtual bool add_fd(int fd, uint32_t event, epoll_callback_info* ci) {
+        void add(int fd, epoll_registration* r) {
             epoll_event ev;
-            ev.events = event;
-            ev.data.ptr = ci;
-            return epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &ev) == 0;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = r;
+            if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &ev) != 0 && errno != EEXIST) {
+                CORO_LOG(error, "epoll_ctl add of fd %d failed: %d", fd, errno);
+            }
         }
 
-        virtual bool remove_fd(int fd) {
-            return epoll_ctl(fd_epoll, EPOLL_CTL_DEL, fd, nullptr) == 0;
+        void remove(int fd) {
+            epoll_ctl(fd_epoll, EPOLL_CTL_DEL, fd, nullptr);
         }
     };
 
-    epoll_awaiter* get_epoll_awaiter();
+    /*
+    The reactors and the fd -> registration table they share. A socket belongs
+    to reactor fd % count for as long as it is registered.
+    */
+    struct epoll_reactors {
+        static constexpr size_t chunk_size = 4096;
+        static constexpr size_t chunk_count = 1024;
+
+        std::vector<epoll_awaiter*> reactors;
+        // fd -> registration, chunks are allocated on first use and never freed
+        // so that events still in flight for a closed fd never touch freed memory
+        std::atomic<epoll_registration*> chunks[chunk_count] = {};
+
+        epoll_reactors(size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                reactors.push_back(new epoll_awaiter(i));
+            }
+        }
+
+        epoll_awaiter* reactor_of(int fd) const {
+            return reactors[(size_t)fd % reactors.size()];
+        }
+
+        epoll_registration* registration(int fd) {
+            if (fd < 0 || (size_t)fd >= chunk_size * chunk_count)
+                return nullptr;
+
+            auto& chunk = chunks[fd / chunk_size];
+            epoll_registration* p = chunk.load(std::memory_order_acquire);
+            if (p == nullptr) {
+                epoll_registration* n = new epoll_registration[chunk_size];
+                if (chunk.compare_exchange_strong(p, n, std::memory_order_acq_rel))
+                    p = n;
+                else
+                    delete[] n;
+            }
+
+            epoll_registration* r = p + fd % chunk_size;
+            bool expected = false;
+            if (!r->registered.load(std::memory_order_acquire)
+                && r->registered.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                // readiness of a new fd is unknown, so the first operation is tried right away
+                r->reader.store(epoll_registration::ready, std::memory_order_release);
+                r->writer.store(epoll_registration::ready, std::memory_order_release);
+                reactor_of(fd)->add(fd, r);
+            }
+            return r;
+        }
+
+        // Must be called before the fd is closed. Waiters still parked on it are
+        // resumed with EBADF, and operations racing with it fail with EBADF until
+        // the fd is registered again.
+        void unregister(int fd) {
+            if (fd < 0 || (size_t)fd >= chunk_size * chunk_count)
+                return;
+            epoll_registration* p = chunks[fd / chunk_size].load(std::memory_order_acquire);
+            if (p == nullptr)
+                return;
+
+            epoll_registration* r = p + fd % chunk_size;
+            bool expected = true;
+            if (!r->registered.compare_exchange_strong(expected, false, std::memory_order_acq_rel))
+                return;
+
+            reactor_of(fd)->remove(fd);
+            r->close(r->reader);
+            r->close(r->writer);
+        }
+    };
+
+    // Sets how many reactors get_epoll_reactors() starts; 0, the default, means one
+    // per worker. Only has an effect before the first socket operation.
+    void set_epoll_reactor_count(size_t count);
+
+    epoll_reactors* get_epoll_reactors();
+
+    /*
+    Optional deadline of an awaiter parked in a registration slot, and the
+    cancellation of its task.
+    The timer lives in the wheel of the fd's own reactor. When it fires, or the
+    task is cancelled, the awaiter is taken back out of the slot; if that fails
+    an event got there first and on_event decides. Checks on both sides after
+    parking close the window in which that happens before the awaiter is in
+    the slot. Without a deadline no timer is added at all.
+    The timer node lives in the awaiter, so every way out takes it out of the
+    wheel: a cancel does right away, and so does the destructor.
+    */
+    struct epoll_deadline : details::timer_node {
+        std::atomic<uintptr_t>* slot = nullptr;
+        epoll_operation* op = nullptr;
+        coroutine_handle handle = nullptr;
+        std::atomic<bool> expired = false;
+        std::atomic<bool> cancelled = false;
+        bool timed_out = false;
+        details::cancel_registration<epoll_deadline> cancel;
+
+        epoll_deadline(uint64_t deadline) {
+            this->deadline = deadline;
+            routine = &epoll_deadline::on_timer;
+        }
+
+        ~epoll_deadline() {
+            stop();
+        }
+
+        bool enabled() const {
+            return deadline != 0;
+        }
+
+        static void on_timer(details::timer_node* self) {
+            auto* d = static_cast<epoll_deadline*>(self);
+            d->expired.store(true);
+            d->give_up();
+        }
+
+        // Must be called before op is parked in slot.
+        void start(int fd, std::atomic<uintptr_t>& s, epoll_operation* o, coroutine_handle h) {
+            slot = &s;
+            op = o;
+            handle = h;
+            if (enabled())
+                get_epoll_reactors()->reactor_of(fd)->add_timer(this);
+            cancel.watch(h.promise().cancel_token, this);
+        }
+
+        void on_cancel() {
+            cancelled.store(true);
+            expired.store(true);
+            stop();
+            give_up();
+        }
+
+        // errno for an awaiter that gave up
+        int reason() const {
+            return cancelled.load() ? ECANCELED : ETIMEDOUT;
+        }
+
+        // Called once op completed without the timer, or gave up without it.
+        void stop() {
+            if (enabled())
+                details::cancel_timer(this);
+        }
+
+        // Called after op was parked: true if the deadline passed in the meantime
+        // and op was taken back out of the slot, so it is not going to be woken.
+        bool withdraw_if_expired() {
+            if (!expired.load())
+                return false;
+            uintptr_t expected = (uintptr_t)op;
+            if (!slot->compare_exchange_strong(expected, epoll_registration::idle))
+                return false;
+            timed_out = true;
+            stop();
+            return true;
+        }
+
+    private:
+        void give_up() {
+            uintptr_t expected = (uintptr_t)op;
+            if (slot != nullptr && slot->compare_exchange_strong(expected, epoll_registration::idle)) {
+                timed_out = true;
+                go(handle);
+            }
+        }
+    };
 }
 
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifdef CORO_USE_IO_URING
+#include "linux_uring.hpp"
+#include <variant>
+#endif
+
 namespace coro::net 
 {
     using socket_t = int;
 
+    // true when coro::net runs on io_uring rather than epoll
+    inline bool use_uring() {
+#ifdef CORO_USE_IO_URING
+        return linux_uring::available();
+#else
+        return false;
+#endif
+    }
+
+    /*
+    When an operation gives up, given either as a point of steady_clock or as a
+    duration from now. Operations that run out of time return -1 with errno set
+    to ETIMEDOUT; the socket stays usable. Likewise, operations of a task that
+    gets cancelled while they wait return -1 with errno set to ECANCELED.
+    */
+    struct deadline {
+        // tick of details::timer_clock, 0 for none
+        uint64_t tick = 0;
+
+        deadline() = default;
+
+        deadline(std::chrono::steady_clock::time_point tp) : tick(std::max<uint64_t>(1, details::tick_of(tp))) {}
+
+        template<typename _Rep, typename _Period>
+        deadline(std::chrono::duration<_Rep, _Period> d)
+            : deadline(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(d)) {}
+    };
+
     inline socket_t socket(int af, int type, int protocol) {
 		socket_t s = ::socket(af, type, protocol);
-        int flag = fcntl(s, F_GETFL, 0);
-        fcntl(s, F_SETFL, flag | O_NONBLOCK);
+        // io_uring waits for the socket itself, epoll needs it to fail with EAGAIN
+        if(s >= 0 && !use_uring()) {
+            int flag = fcntl(s, F_GETFL, 0);
+            fcntl(s, F_SETFL, flag | O_NONBLOCK);
+        }
         return s;
 	}
 
@@ -102,64 +496,90 @@ namespace coro::net
 		return ::listen(socket, backlog);
 	}
 
-    struct epoll_accept_awaiter {
+    struct epoll_accept_awaiter : linux_epoll::epoll_operation {
         socket_t fd;
         sockaddr* sock;
         socklen_t* namelen;
 
         socket_t result;
+        // errno of a failure seen on the reactor
+        int error = 0;
 
-        linux_epoll::epoll_callback_info cb_info;
+        linux_epoll::epoll_registration* reg = nullptr;
+        coroutine_handle handle = nullptr;
+        linux_epoll::epoll_deadline timeout;
 
-        epoll_accept_awaiter(socket_t fd, sockaddr* addr, socklen_t* namelen) : fd(fd), sock(addr), namelen(namelen){
+        epoll_accept_awaiter(socket_t fd, sockaddr* addr, socklen_t* namelen, uint64_t deadline = 0)
+            : fd(fd), sock(addr), namelen(namelen), timeout(deadline) {
+            routine = &linux_epoll::epoll_routine_t<epoll_accept_awaiter>;
+        }
 
+        linux_epoll::io_attempt try_accept() {
+            // accepted sockets must not block the worker that reads them
+            result = ::accept4(fd, sock, namelen, SOCK_NONBLOCK);
+            if(result < 0 && errno == EAGAIN)
+                return linux_epoll::io_attempt::blocked;
+            return linux_epoll::io_attempt::done;
         }
 
         bool await_ready() {
-            result = ::accept(fd, sock, namelen);
-            if(result > 0)
-                return true;
-            bool res = errno != EAGAIN;
-            printf("await_ready return %s\n", res?"true":"false");
-            return res;
-        }
-
-        bool await_suspend(coroutine_handle handle) {
-            linux_epoll::init_epoll_cb(&cb_info, "accept_callback", [this, handle](uint32_t event, int error){
-                fflush(stdout);
-                if(!linux_epoll::get_epoll_awaiter()->remove_fd(fd))
-                    printf("remove fd %d failed!\n", fd);
-                printf("accept await_suspend : event = %d, errno = %d\n", event, errno);
-                if(event & EPOLLIN) {
-                    result = ::accept(fd, sock, namelen);
-                    printf("await_suspend callback: result = %d, errno = %d\n", result, errno);
-                } else {
-                    // something went wrong
-                    result = -1;
-                    printf("await_suspend callback: result = %d\n", result);
-                }
-                go(handle);
-                return;
-            });
-
-            if(linux_epoll::get_epoll_awaiter()->add_fd(fd, EPOLLIN|EPOLLERR|EPOLLONESHOT, &cb_info)) {
-                park(handle);
+            reg = linux_epoll::get_epoll_reactors()->registration(fd);
+            if(reg == nullptr) {
+                result = -1;
+                error = EBADF;
                 return true;
             }
+            if(reg->try_ready(reg->reader, [this]() { return try_accept(); }))
+                return true;
+            CORO_LOG(trace, "accept on fd %d waits", fd);
             return false;
         }
 
+        void on_event(uint32_t event, int err) {
+            CORO_LOG(trace, "accept on fd %d: event %u, error %d", fd, event, err);
+            if(err != 0) {
+                result = -1;
+                error = err;
+            } else if(reg->arm(reg->reader, this, [this]() { return try_accept(); }, err)) {
+                if(!timeout.withdraw_if_expired())
+                    return;
+            } else if(err != 0) {
+                result = -1;
+                error = err;
+            }
+            timeout.stop();
+            go(handle);
+        }
+
+        bool await_suspend(root_handle h) {
+            handle = h;
+            timeout.start(fd, reg->reader, this, handle);
+            if(!reg->arm(reg->reader, this, [this]() { return try_accept(); }, error)) {
+                if(error != 0)
+                    result = -1;
+                timeout.stop();
+                return false;
+            }
+            if(timeout.withdraw_if_expired())
+                return false;
+            park(handle, "accept");
+            return true;
+        }
+
         socket_t await_resume() {
-            printf("accept return %d\n", result);
+            if(timeout.timed_out) {
+                errno = timeout.reason();
+                return -1;
+            }
+            CORO_LOG(trace, "accept on fd %d returns %d", fd, result);
+            if(result < 0 && error != 0)
+                errno = error;
             return result;
         }
     };
 
-    inline epoll_accept_awaiter accept(socket_t fd, sockaddr* addr, socklen_t* namelen) {
-        return {fd, addr, namelen};
-    }
 
-    struct epoll_recv_awaiter {
+    struct epoll_recv_awaiter : linux_epoll::epoll_operation {
         socket_t fd;
         char* buffer;
         size_t bufflen;
@@ -167,98 +587,341 @@ namespace coro::net
 
         size_t already_readed = 0;
         int result;
+        // errno of a failure seen on the reactor
+        int error = 0;
 
-        linux_epoll::epoll_callback_info cb_info;
+        linux_epoll::epoll_registration* reg = nullptr;
+        coroutine_handle handle = nullptr;
+        linux_epoll::epoll_deadline timeout;
+        [[no_unique_address]] metrics::details::stopwatch latency;
 
-        epoll_recv_awaiter(socket_t fd, char* buffer, size_t len, int flag) : fd(fd), buffer(buffer), bufflen(len), flag(flag){
+        epoll_recv_awaiter(socket_t fd, char* buffer, size_t len, int flag, uint64_t deadline = 0)
+            : fd(fd), buffer(buffer), bufflen(len), flag(flag), timeout(deadline) {
+            routine = &linux_epoll::epoll_routine_t<epoll_recv_awaiter>;
+        }
 
+        linux_epoll::io_attempt try_recv() {
+            while (true) {
+                size_t wanted = bufflen - already_readed;
+                int ret = ::recv(fd, buffer + already_readed, wanted, flag);
+                if(ret > 0) {
+                    already_readed += ret;
+                    if(flag & MSG_WAITALL && already_readed != bufflen)
+                        continue;
+                    result = (int)already_readed;
+                    return (size_t)ret < wanted ? linux_epoll::io_attempt::drained : linux_epoll::io_attempt::done;
+                }
+                if(ret < 0 && errno == EAGAIN)
+                    return linux_epoll::io_attempt::blocked;
+                // orderly shutdown or error, hand over what we already have
+                result = already_readed > 0 ? (int)already_readed : ret;
+                return linux_epoll::io_attempt::done;
+            }
         }
 
+        // try the socket first, a request/response peer often has the data buffered already
         bool await_ready() {
-            return false;
+            already_readed = 0;
+            reg = linux_epoll::get_epoll_reactors()->registration(fd);
+            if(reg == nullptr) {
+                result = -1;
+                error = EBADF;
+                return true;
+            }
+            return reg->try_ready(reg->reader, [this]() { return try_recv(); });
         }
 
-        bool await_suspend(coroutine_handle handle) {
-            already_readed = 0;
-            linux_epoll::init_epoll_cb(&cb_info, "recv_callback", [this, handle](uint32_t event, int error){
-                if(event & EPOLLIN) {
-                    result = ::recv(fd, buffer + already_readed, bufflen - already_readed, flag);
-                    if(result > 0) {
-                        already_readed += result;
-                        if(flag & MSG_WAITALL && already_readed != bufflen) {
-                            return;
-                        } else {
-                            result += already_readed;
-                        }
-                    }
-                } else {
-                    result = -1;
-                }
-                linux_epoll::get_epoll_awaiter()->remove_fd(fd);
-                go(handle);
-                return;
-            });
+        void on_event(uint32_t, int err) {
+            if(err != 0) {
+                result = already_readed > 0 ? (int)already_readed : -1;
+                error = err;
+            } else if(reg->arm(reg->reader, this, [this]() { return try_recv(); }, err)) {
+                if(!timeout.withdraw_if_expired())
+                    return;
+            } else if(err != 0) {
+                result = already_readed > 0 ? (int)already_readed : -1;
+                error = err;
+            }
+            timeout.stop();
+            go(handle);
+        }
 
-            if(linux_epoll::get_epoll_awaiter()->add_fd(fd, EPOLLIN|EPOLLERR, &cb_info)) {
-                park(handle);
-                return true;
+        bool await_suspend(root_handle h) {
+            handle = h;
+            timeout.start(fd, reg->reader, this, handle);
+            if(!reg->arm(reg->reader, this, [this]() { return try_recv(); }, error)) {
+                if(error != 0)
+                    result = already_readed > 0 ? (int)already_readed : -1;
+                timeout.stop();
+                return false;
             }
-            return false; 
+            if(timeout.withdraw_if_expired())
+                return false;
+            park(handle, "recv");
+            return true;
         }
 
         int await_resume() {
+            latency.stop(metrics::series::recv_ns);
+            // a timeout still hands over what MSG_WAITALL collected so far
+            if(timeout.timed_out) {
+                if(already_readed > 0)
+                    return (int)already_readed;
+                errno = timeout.reason();
+                return -1;
+            }
+            if(result < 0 && error != 0)
+                errno = error;
             return result;
         }
     };
 
-    inline epoll_recv_awaiter recv(socket_t fd, char* buff, size_t len, int flag) {
-        return { fd, buff, len, flag };
-    }
 
-    struct epoll_send_awaiter  {
+    struct epoll_send_awaiter : linux_epoll::epoll_operation {
         socket_t fd;
         const char* buffer;
         size_t bufflen;
         int flag;
 
         int result;
-        linux_epoll::epoll_callback_info cb_info;
-        
-        epoll_send_awaiter(socket_t fd, const char* buff, size_t len, int flag)
-            :fd(fd), buffer(buff), bufflen(len), flag(flag), result(-1) {}
-
-        constexpr bool await_ready() const { return false; }
-
-        bool await_suspend(coroutine_handle handle) {
-            linux_epoll::init_epoll_cb(&cb_info, "send_callback", [this, handle](uint32_t event, int err){
-                linux_epoll::get_epoll_awaiter()->remove_fd(fd);
-                if(event & EPOLLOUT) {
-                    result = ::send(fd, buffer, bufflen, flag);
-                } else {
-                    result = -1;
-                }
-                go(handle);
-            });
+        // errno of a failure seen on the reactor
+        int error = 0;
+        linux_epoll::epoll_registration* reg = nullptr;
+        coroutine_handle handle = nullptr;
+        linux_epoll::epoll_deadline timeout;
+        [[no_unique_address]] metrics::details::stopwatch latency;
+
+        epoll_send_awaiter(socket_t fd, const char* buff, size_t len, int flag, uint64_t deadline = 0)
+            :fd(fd), buffer(buff), bufflen(len), flag(flag), result(-1), timeout(deadline) {
+            routine = &linux_epoll::epoll_routine_t<epoll_send_awaiter>;
+        }
+
+        linux_epoll::io_attempt try_send() {
+            result = ::send(fd, buffer, bufflen, flag);
+            if(result < 0 && errno == EAGAIN)
+                return linux_epoll::io_attempt::blocked;
+            if(result >= 0 && (size_t)result < bufflen)
+                return linux_epoll::io_attempt::drained;
+            return linux_epoll::io_attempt::done;
+        }
 
-            if(!linux_epoll::get_epoll_awaiter()->add_fd(fd, EPOLLOUT|EPOLLONESHOT|EPOLLERR, &cb_info)) {
+        bool await_ready() {
+            reg = linux_epoll::get_epoll_reactors()->registration(fd);
+            if(reg == nullptr) {
                 result = -1;
+                error = EBADF;
+                return true;
+            }
+            return reg->try_ready(reg->writer, [this]() { return try_send(); });
+        }
+
+        void on_event(uint32_t, int err) {
+            if(err != 0) {
+                result = -1;
+                error = err;
+            } else if(reg->arm(reg->writer, this, [this]() { return try_send(); }, err)) {
+                if(!timeout.withdraw_if_expired())
+                    return;
+            } else if(err != 0) {
+                result = -1;
+                error = err;
+            }
+            timeout.stop();
+            go(handle);
+        }
+
+        bool await_suspend(root_handle h) {
+            handle = h;
+            timeout.start(fd, reg->writer, this, handle);
+            if(!reg->arm(reg->writer, this, [this]() { return try_send(); }, error)) {
+                if(error != 0)
+                    result = -1;
+                timeout.stop();
+                return false;
+            }
+            if(timeout.withdraw_if_expired())
                 return false;
+            park(handle, "send");
+            return true;
+        }
+
+        int await_resume() const {
+            latency.stop(metrics::series::send_ns);
+            if(timeout.timed_out) {
+                errno = timeout.reason();
+                return -1;
+            }
+            if(result < 0 && error != 0)
+                errno = error;
+            return result;
+        }
+    };
+
+    struct epoll_connect_awaiter : linux_epoll::epoll_operation {
+        socket_t fd;
+        const sockaddr* addr;
+        socklen_t addrlen;
+
+        int result = -1;
+        int error = 0;
+        bool started = false;
+        linux_epoll::epoll_registration* reg = nullptr;
+        coroutine_handle handle = nullptr;
+        linux_epoll::epoll_deadline timeout;
+
+        epoll_connect_awaiter(socket_t fd, const sockaddr* addr, socklen_t addrlen, uint64_t deadline = 0)
+            : fd(fd), addr(addr), addrlen(addrlen), timeout(deadline) {
+            routine = &linux_epoll::epoll_routine_t<epoll_connect_awaiter>;
+        }
+
+        // connect() again tells whether the handshake finished, is still going or failed
+        linux_epoll::io_attempt try_connect() {
+            if(::connect(fd, addr, addrlen) == 0 || (started && errno == EISCONN)) {
+                result = 0;
+                return linux_epoll::io_attempt::done;
+            }
+            if(errno == EINPROGRESS || errno == EALREADY) {
+                started = true;
+                return linux_epoll::io_attempt::blocked;
+            }
+            result = -1;
+            error = errno;
+            return linux_epoll::io_attempt::done;
+        }
+
+        bool await_ready() {
+            reg = linux_epoll::get_epoll_reactors()->registration(fd);
+            if(reg == nullptr) {
+                error = EBADF;
+                return true;
             }
+            return reg->try_ready(reg->writer, [this]() { return try_connect(); });
+        }
+
+        void on_event(uint32_t, int err) {
+            if(err != 0) {
+                result = -1;
+                error = err;
+            } else if(reg->arm(reg->writer, this, [this]() { return try_connect(); }, err)) {
+                if(!timeout.withdraw_if_expired())
+                    return;
+            } else if(err != 0) {
+                result = -1;
+                error = err;
+            }
+            timeout.stop();
+            go(handle);
+        }
 
-            park(handle);
+        bool await_suspend(root_handle h) {
+            handle = h;
+            timeout.start(fd, reg->writer, this, handle);
+            if(!reg->arm(reg->writer, this, [this]() { return try_connect(); }, error)) {
+                if(error != 0)
+                    result = -1;
+                timeout.stop();
+                return false;
+            }
+            if(timeout.withdraw_if_expired())
+                return false;
+            park(handle, "connect");
             return true;
         }
 
         int await_resume() const {
+            if(timeout.timed_out) {
+                errno = timeout.reason();
+                return -1;
+            }
+            // the failure may have been seen on the epoll thread
+            if(result != 0)
+                errno = error;
             return result;
         }
     };
 
-    inline epoll_send_awaiter send(socket_t fd, const char* buffer, size_t len, int flag) {
-        return { fd, buffer, len, flag };
+#ifdef CORO_USE_IO_URING
+    /*
+    Runs either the epoll or the io_uring flavour of an operation, picked when
+    the awaiter is created. io_uring results are turned into the -1/errno
+    convention of the epoll side.
+    */
+    template<typename _Epoll, typename _Uring>
+    struct io_awaiter {
+        std::variant<_Epoll, _Uring> impl;
+
+        template<size_t _Index, typename... _Args>
+        io_awaiter(std::in_place_index_t<_Index> index, _Args&&... args) : impl(index, std::forward<_Args>(args)...) {}
+
+        bool await_ready() {
+            return std::visit([](auto& a) { return (bool)a.await_ready(); }, impl);
+        }
+
+        bool await_suspend(root_handle handle) {
+            return std::visit([handle](auto& a) { return (bool)a.await_suspend(handle); }, impl);
+        }
+
+        int await_resume() {
+            if(impl.index() == 0)
+                return std::get<0>(impl).await_resume();
+            int result = std::get<1>(impl).await_resume();
+            if(result < 0) {
+                errno = -result;
+                return -1;
+            }
+            return result;
+        }
+    };
+
+    using accept_awaiter = io_awaiter<epoll_accept_awaiter, linux_uring::accept_awaiter>;
+    using recv_awaiter = io_awaiter<epoll_recv_awaiter, linux_uring::recv_awaiter>;
+    using send_awaiter = io_awaiter<epoll_send_awaiter, linux_uring::send_awaiter>;
+    using connect_awaiter = io_awaiter<epoll_connect_awaiter, linux_uring::connect_awaiter>;
+
+    inline accept_awaiter accept(socket_t fd, sockaddr* addr, socklen_t* namelen, deadline until = {}) {
+        if(use_uring())
+            return { std::in_place_index<1>, linux_uring::accept_prep{ fd, addr, namelen, 0 }, until.tick };
+        return { std::in_place_index<0>, fd, addr, namelen, until.tick };
+    }
+
+    inline recv_awaiter recv(socket_t fd, char* buff, size_t len, int flag, deadline until = {}) {
+        if(use_uring())
+            return { std::in_place_index<1>, linux_uring::recv_prep{ fd, buff, len, flag }, until.tick };
+        return { std::in_place_index<0>, fd, buff, len, flag, until.tick };
     }
 
+    inline send_awaiter send(socket_t fd, const char* buffer, size_t len, int flag, deadline until = {}) {
+        if(use_uring())
+            return { std::in_place_index<1>, linux_uring::send_prep{ fd, buffer, len, flag }, until.tick };
+        return { std::in_place_index<0>, fd, buffer, len, flag, until.tick };
+    }
+
+    inline connect_awaiter connect(socket_t fd, const sockaddr* addr, int namelen, deadline until = {}) {
+        if(use_uring())
+            return { std::in_place_index<1>, linux_uring::connect_prep{ fd, addr, (socklen_t)namelen }, until.tick };
+        return { std::in_place_index<0>, fd, addr, (socklen_t)namelen, until.tick };
+    }
+#else
+    inline epoll_accept_awaiter accept(socket_t fd, sockaddr* addr, socklen_t* namelen, deadline until = {}) {
+        return { fd, addr, namelen, until.tick };
+    }
+
+    inline epoll_recv_awaiter recv(socket_t fd, char* buff, size_t len, int flag, deadline until = {}) {
+        return { fd, buff, len, flag, until.tick };
+    }
+
+    inline epoll_send_awaiter send(socket_t fd, const char* buffer, size_t len, int flag, deadline until = {}) {
+        return { fd, buffer, len, flag, until.tick };
+    }
+
+    inline epoll_connect_awaiter connect(socket_t fd, const sockaddr* addr, int namelen, deadline until = {}) {
+        return { fd, addr, (socklen_t)namelen, until.tick };
+    }
+#endif
+
     inline void close_socket(socket_t socket) {
+        if(!use_uring())
+            linux_epoll::get_epoll_reactors()->unregister(socket);
 		close(socket);
 	}
 
@@ -0,0 +1,838 @@
+#ifndef _LINUX_URING_H_
+#define _LINUX_URING_H_
+
+#ifndef __linux__
+#error "This header is only for use on Linux systems."
+#else
+
+#include "scheduler.hpp"
+#include "awaiters.hpp"
+#include "timer.hpp"
+#include "log.hpp"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <thread>
+
+namespace coro::linux_uring {
+
+    /*
+    Completion based backend. Operations are written to the SQ ring by the
+    worker that awaits them and submitted in batches: while the reactor thread
+    is busy draining completions, new entries just pile up and go out with its
+    next io_uring_enter; only when it is blocked does the submitting worker
+    enter the kernel itself.
+    Every request carries a plain function pointer that the reactor calls with
+    the cqe result (a negative errno on failure) and the cqe flags.
+    */
+    struct uring_request {
+        void (*routine)(uring_request* self, int32_t res, uint32_t flags) = nullptr;
+    };
+
+    inline int io_uring_setup(unsigned entries, io_uring_params* p) {
+        return (int)::syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return (int)::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    inline int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+        return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    struct uring_awaiter final : coro::thread_awaiter {
+        static constexpr unsigned ring_entries = 1024;
+
+        int ring_fd = -1;
+
+        unsigned* sq_head = nullptr;
+        unsigned* sq_tail = nullptr;
+        unsigned* sq_array = nullptr;
+        unsigned sq_mask = 0;
+        unsigned sq_entries = 0;
+        io_uring_sqe* sqes = nullptr;
+
+        unsigned* cq_head = nullptr;
+        unsigned* cq_tail = nullptr;
+        unsigned cq_mask = 0;
+        io_uring_cqe* cqes = nullptr;
+
+        void* sq_ptr = MAP_FAILED;
+        size_t sq_size = 0;
+        void* cq_ptr = MAP_FAILED;
+        size_t cq_size = 0;
+        size_t sqes_size = 0;
+
+        // guards the SQ ring and the two fields below
+        std::mutex sq_mtx;
+        // entries written to the ring but not yet handed to the kernel
+        unsigned to_submit = 0;
+        // the reactor is (about to be) blocked in io_uring_enter
+        bool waiting = false;
+
+        uring_awaiter() {
+            io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            ring_fd = io_uring_setup(ring_entries, &p);
+            if (ring_fd < 0)
+                return;
+
+            sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            if (p.features & IORING_FEAT_SINGLE_MMAP)
+                sq_size = cq_size = std::max(sq_size, cq_size);
+
+            sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+            if (sq_ptr == MAP_FAILED) {
+                release();
+                return;
+            }
+            if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                cq_ptr = sq_ptr;
+            }
+            else {
+                cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+                if (cq_ptr == MAP_FAILED) {
+                    release();
+                    return;
+                }
+            }
+
+            sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+            void* sqe_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+            if (sqe_ptr == MAP_FAILED) {
+                release();
+                return;
+            }
+            sqes = (io_uring_sqe*)sqe_ptr;
+
+            char* sq = (char*)sq_ptr;
+            sq_head = (unsigned*)(sq + p.sq_off.head);
+            sq_tail = (unsigned*)(sq + p.sq_off.tail);
+            sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+            sq_entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+            sq_array = (unsigned*)(sq + p.sq_off.array);
+
+            char* cq = (char*)cq_ptr;
+            cq_head = (unsigned*)(cq + p.cq_off.head);
+            cq_tail = (unsigned*)(cq + p.cq_off.tail);
+            cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+            cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        }
+
+        ~uring_awaiter() {
+            release();
+        }
+
+        bool available() const {
+            return ring_fd >= 0;
+        }
+
+        void release() {
+            if (sqes != nullptr)
+                munmap(sqes, sqes_size);
+            if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+                munmap(cq_ptr, cq_size);
+            if (sq_ptr != MAP_FAILED)
+                munmap(sq_ptr, sq_size);
+            if (ring_fd >= 0)
+                close(ring_fd);
+            sqes = nullptr;
+            sq_ptr = cq_ptr = MAP_FAILED;
+            ring_fd = -1;
+        }
+
+        virtual void wait(std::vector<coroutine_handle>& handles) override {
+            unsigned submit;
+            {
+                std::lock_guard<std::mutex> lg(sq_mtx);
+                submit = to_submit;
+                to_submit = 0;
+                waiting = true;
+            }
+
+            bool has_cqe = std::atomic_ref<unsigned>(*cq_head).load(std::memory_order_relaxed)
+                != std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+            int ret = io_uring_enter(ring_fd, submit, has_cqe ? 0 : 1, IORING_ENTER_GETEVENTS);
+
+            {
+                std::lock_guard<std::mutex> lg(sq_mtx);
+                waiting = false;
+                if (ret < 0) {
+                    to_submit += submit;
+                }
+                else if ((unsigned)ret < submit) {
+                    to_submit += submit - (unsigned)ret;
+                }
+            }
+
+            if (ret < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+                CORO_LOG(error, "io_uring_enter failed: %d", errno);
+
+            unsigned head = std::atomic_ref<unsigned>(*cq_head).load(std::memory_order_relaxed);
+            unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+            metrics::details::count(metrics::event::reactor_wakeup);
+            metrics::details::record(metrics::series::reactor_batch, tail - head);
+            // everything woken by this turn goes to the scheduler in one batch
+            coro::collect_wakeups(&handles);
+            for (; head != tail; head++) {
+                io_uring_cqe cqe = cqes[head & cq_mask];
+                // hand the slot back before the routine runs, it may submit again
+                std::atomic_ref<unsigned>(*cq_head).store(head + 1, std::memory_order_release);
+                uring_request* req = (uring_request*)cqe.user_data;
+                if (req != nullptr && req->routine != nullptr) {
+                    req->routine(req, cqe.res, cqe.flags);
+                }
+            }
+            coro::collect_wakeups(nullptr);
+        }
+
+        virtual bool should_suspend() const override {
+            return false;
+        }
+
+        // Fills an sqe with prep and queues it. Returns false if the ring is unusable.
+        // A null req submits without asking for the completion.
+        // With a timeout (absolute, CLOCK_MONOTONIC) the operation is cancelled when
+        // it is still pending by then, and completes with -ECANCELED.
+        template<typename _Prep>
+        bool submit(uring_request* req, _Prep&& prep, const __kernel_timespec* timeout = nullptr) {
+            if (!available())
+                return false;
+
+            std::unique_lock<std::mutex> lk(sq_mtx);
+            unsigned needed = timeout != nullptr ? 2 : 1;
+            while (!has_room(needed)) {
+                // the kernel has not consumed enough entries yet, push them through
+                flush_locked();
+                if (has_room(needed))
+                    break;
+                // the reactor may hold them, and needs the lock to hand back what it could not submit
+                lk.unlock();
+                std::this_thread::yield();
+                lk.lock();
+            }
+            unsigned tail = *sq_tail;
+
+            unsigned index = tail & sq_mask;
+            io_uring_sqe* sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            prep(sqe);
+            sqe->user_data = (uint64_t)req;
+            sq_array[index] = index;
+
+            if (timeout != nullptr) {
+                sqe->flags |= IOSQE_IO_LINK;
+                unsigned link_index = (tail + 1) & sq_mask;
+                io_uring_sqe* link = &sqes[link_index];
+                memset(link, 0, sizeof(*link));
+                link->opcode = IORING_OP_LINK_TIMEOUT;
+                link->fd = -1;
+                link->addr = (uint64_t)timeout;
+                link->len = 1;
+                link->timeout_flags = IORING_TIMEOUT_ABS;
+                sq_array[link_index] = link_index;
+            }
+
+            std::atomic_ref<unsigned>(*sq_tail).store(tail + needed, std::memory_order_release);
+            to_submit += needed;
+
+            // nobody else is going to enter the kernel any time soon
+            if (waiting)
+                flush_locked();
+            return true;
+        }
+
+        // Must be called with sq_mtx held.
+        bool has_room(unsigned needed) const {
+            return *sq_tail + needed - std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire) <= sq_entries;
+        }
+
+        // Must be called with sq_mtx held.
+        void flush_locked() {
+            if (to_submit == 0)
+                return;
+            int ret = io_uring_enter(ring_fd, to_submit, 0, 0);
+            if (ret > 0)
+                to_submit -= std::min<unsigned>((unsigned)ret, to_submit);
+        }
+
+        int register_buffers(const iovec* buffers, unsigned count) {
+            return io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, buffers, count);
+        }
+
+        int unregister_buffers() {
+            return io_uring_register(ring_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        }
+    };
+
+    // Returns nullptr when io_uring is not available (old kernel, seccomp, or
+    // LIBCORO_NO_IO_URING set in the environment); callers fall back to epoll then.
+    uring_awaiter* get_uring_awaiter();
+
+    inline bool available() {
+        return get_uring_awaiter() != nullptr;
+    }
+
+    /*
+    Awaiter for a single-shot operation. _Prep fills the sqe, the coroutine is
+    parked until the completion arrives. await_resume() returns the raw cqe
+    result, i.e. -errno on failure, and -ETIMEDOUT when the deadline (a tick of
+    details::timer_clock, 0 for none) passed first. Cancelling the task asks the
+    kernel to cancel the operation, which then completes with -ECANCELED.
+    */
+    template<typename _Prep>
+    struct uring_op_awaiter : uring_request {
+        _Prep prep;
+        int32_t result = -ENOSYS;
+        coroutine_handle handle = nullptr;
+        // read by the kernel while the sqes are prepared, so it only has to outlive the submission
+        __kernel_timespec timeout = {};
+        bool has_timeout = false;
+        std::atomic<bool> cancelled = false;
+        details::cancel_registration<uring_op_awaiter> cancel;
+        [[no_unique_address]] metrics::details::stopwatch latency;
+
+        uring_op_awaiter(const _Prep& prep, uint64_t deadline = 0) : prep(prep) {
+            routine = &uring_op_awaiter::on_complete;
+            if (deadline != 0) {
+                auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(details::timer_tick(deadline));
+                timeout.tv_sec = since_epoch.count() / 1000000000;
+                timeout.tv_nsec = since_epoch.count() % 1000000000;
+                has_timeout = true;
+            }
+        }
+
+        uring_op_awaiter(const uring_op_awaiter&) = delete;
+        uring_op_awaiter& operator=(const uring_op_awaiter&) = delete;
+
+        static void on_complete(uring_request* self, int32_t res, uint32_t) {
+            auto* op = static_cast<uring_op_awaiter*>(self);
+            if (res == -ECANCELED || res == -EINTR) {
+                if (op->cancelled.load())
+                    res = -ECANCELED;
+                else if (op->has_timeout)
+                    res = -ETIMEDOUT;
+            }
+            op->result = res;
+            go(op->handle);
+        }
+
+        void on_cancel() {
+            cancelled.store(true);
+            // harmless when the operation completed in the meantime, the kernel no longer knows it
+            get_uring_awaiter()->submit(nullptr, [this](io_uring_sqe* sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = (uint64_t)(uring_request*)this;
+            });
+        }
+
+        bool await_ready() {
+            return false;
+        }
+
+        bool await_suspend(root_handle h) {
+            handle = h;
+            auto ring = get_uring_awaiter();
+            if (ring == nullptr || !ring->submit(this, prep, has_timeout ? &timeout : nullptr))
+                return false;
+            park(h, "io_uring");
+            cancel.watch(h.promise().cancel_token, this);
+            return true;
+        }
+
+        int32_t await_resume() const {
+            if constexpr (requires { _Prep::latency; })
+                latency.stop(_Prep::latency);
+            return result;
+        }
+    };
+
+    struct recv_prep {
+        int fd; char* buffer; size_t len; int flags;
+        static constexpr auto latency = metrics::series::recv_ns;
+        void operator()(io_uring_sqe* sqe) const {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)buffer;
+            sqe->len = (uint32_t)len;
+            sqe->msg_flags = (uint32_t)flags;
+        }
+    };
+
+    struct send_prep {
+        int fd; const char* buffer; size_t len; int flags;
+        static constexpr auto latency = metrics::series::send_ns;
+        void operator()(io_uring_sqe* sqe) const {
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)buffer;
+            sqe->len = (uint32_t)len;
+            sqe->msg_flags = (uint32_t)flags;
+        }
+    };
+
+    struct accept_prep {
+        int fd; sockaddr* addr; socklen_t* addrlen; int flags;
+        void operator()(io_uring_sqe* sqe) const {
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)addr;
+            sqe->addr2 = (uint64_t)addrlen;
+            sqe->accept_flags = (uint32_t)flags;
+        }
+    };
+
+    struct connect_prep {
+        int fd; const sockaddr* addr; socklen_t addrlen;
+        void operator()(io_uring_sqe* sqe) const {
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)addr;
+            sqe->off = (uint64_t)addrlen;
+        }
+    };
+
+    // offset -1 uses (and advances) the file position
+    struct rw_prep {
+        uint8_t opcode; int fd; const void* buffer; size_t len; uint64_t offset; uint16_t buf_index;
+        void operator()(io_uring_sqe* sqe) const {
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)buffer;
+            sqe->len = (uint32_t)len;
+            sqe->off = offset;
+            sqe->buf_index = buf_index;
+        }
+    };
+
+    struct close_prep {
+        int fd;
+        void operator()(io_uring_sqe* sqe) const {
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fd;
+        }
+    };
+
+    using recv_awaiter = uring_op_awaiter<recv_prep>;
+    using send_awaiter = uring_op_awaiter<send_prep>;
+    using accept_awaiter = uring_op_awaiter<accept_prep>;
+    using connect_awaiter = uring_op_awaiter<connect_prep>;
+    using rw_awaiter = uring_op_awaiter<rw_prep>;
+    using close_awaiter = uring_op_awaiter<close_prep>;
+
+    inline recv_awaiter recv(int fd, char* buffer, size_t len, int flags) {
+        return recv_prep{ fd, buffer, len, flags };
+    }
+
+    inline send_awaiter send(int fd, const char* buffer, size_t len, int flags) {
+        return send_prep{ fd, buffer, len, flags };
+    }
+
+    inline accept_awaiter accept(int fd, sockaddr* addr, socklen_t* addrlen, int flags = 0) {
+        return accept_prep{ fd, addr, addrlen, flags };
+    }
+
+    inline connect_awaiter connect(int fd, const sockaddr* addr, socklen_t addrlen) {
+        return connect_prep{ fd, addr, addrlen };
+    }
+
+    inline rw_awaiter read(int fd, void* buffer, size_t len, uint64_t offset = (uint64_t)-1) {
+        return rw_prep{ IORING_OP_READ, fd, buffer, len, offset, 0 };
+    }
+
+    inline rw_awaiter write(int fd, const void* buffer, size_t len, uint64_t offset = (uint64_t)-1) {
+        return rw_prep{ IORING_OP_WRITE, fd, buffer, len, offset, 0 };
+    }
+
+    // buffer must lie inside the registered buffer buf_index, see register_buffers()
+    inline rw_awaiter read_fixed(int fd, void* buffer, size_t len, uint16_t buf_index, uint64_t offset = (uint64_t)-1) {
+        return rw_prep{ IORING_OP_READ_FIXED, fd, buffer, len, offset, buf_index };
+    }
+
+    inline rw_awaiter write_fixed(int fd, const void* buffer, size_t len, uint16_t buf_index, uint64_t offset = (uint64_t)-1) {
+        return rw_prep{ IORING_OP_WRITE_FIXED, fd, buffer, len, offset, buf_index };
+    }
+
+    inline close_awaiter close(int fd) {
+        return close_prep{ fd };
+    }
+
+    // Pins buffers in the kernel for read_fixed/write_fixed, saving the page
+    // walk on every operation. Returns 0 or -errno.
+    inline int register_buffers(const iovec* buffers, unsigned count) {
+        auto ring = get_uring_awaiter();
+        if (ring == nullptr)
+            return -ENOSYS;
+        return ring->register_buffers(buffers, count) < 0 ? -errno : 0;
+    }
+
+    // Cancels the multishot request req and waits for its last completion, after
+    // which the kernel no longer refers to it. armed is cleared by the completion routine.
+    inline void cancel_multishot(uring_request* req, spin_lock& lock, const bool& armed) {
+        {
+            std::lock_guard<spin_lock> lg(lock);
+            if (!armed)
+                return;
+        }
+        auto ring = get_uring_awaiter();
+        ring->submit(nullptr, [req](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t)req;
+        });
+        while (true) {
+            {
+                std::lock_guard<spin_lock> lg(lock);
+                if (!armed)
+                    return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /*
+    Keeps one multishot accept armed on a listening socket: every connection the
+    kernel accepts is queued here until a coroutine asks for it.
+    Only one coroutine may wait in accept() at a time; destroying the acceptor
+    cancels the request and closes connections nobody took.
+    */
+    struct multishot_acceptor : uring_request {
+        int fd;
+        spin_lock lock;
+        std::deque<int> accepted;
+        coroutine_handle waiter = nullptr;
+        // the kernel dropped the request (error or no more CQE_F_MORE), re-arm on next accept
+        bool armed = false;
+        int last_error = 0;
+
+        multishot_acceptor(int fd) : fd(fd) {
+            routine = &multishot_acceptor::on_complete;
+        }
+
+        ~multishot_acceptor() {
+            cancel_multishot(this, lock, armed);
+            for (int s : accepted)
+                ::close(s);
+        }
+
+        multishot_acceptor(const multishot_acceptor&) = delete;
+        multishot_acceptor& operator=(const multishot_acceptor&) = delete;
+
+        static void on_complete(uring_request* self, int32_t res, uint32_t flags) {
+            auto* a = static_cast<multishot_acceptor*>(self);
+            coroutine_handle h = nullptr;
+            {
+                std::lock_guard<spin_lock> lg(a->lock);
+                if (res >= 0)
+                    a->accepted.push_back(res);
+                else
+                    a->last_error = res;
+                if (!(flags & IORING_CQE_F_MORE))
+                    a->armed = false;
+                std::swap(h, a->waiter);
+            }
+            if (h != nullptr)
+                go(h);
+        }
+
+        // Called without the lock, which the reactor needs to deliver completions.
+        bool arm() {
+            auto ring = get_uring_awaiter();
+            return ring != nullptr && ring->submit(this, [this](io_uring_sqe* sqe) {
+                sqe->opcode = IORING_OP_ACCEPT;
+                sqe->fd = fd;
+                sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            });
+        }
+
+        struct multishot_accept_awaiter {
+            multishot_acceptor& a;
+            int result = -ENOSYS;
+            bool taken = false;
+
+            bool await_ready() {
+                std::lock_guard<spin_lock> lg(a.lock);
+                return take();
+            }
+
+            bool await_suspend(root_handle h) {
+                bool arming;
+                {
+                    std::lock_guard<spin_lock> lg(a.lock);
+                    if (take())
+                        return false;
+                    a.waiter = h;
+                    arming = !a.armed;
+                    a.armed = true;
+                }
+                // nothing can complete before the request is in, so the waiter is still ours on failure
+                if (arming && !a.arm()) {
+                    std::lock_guard<spin_lock> lg(a.lock);
+                    a.armed = false;
+                    a.waiter = nullptr;
+                    result = -ENOSYS;
+                    return false;
+                }
+                park(h, "accept");
+                return true;
+            }
+
+            int await_resume() {
+                if (!taken) {
+                    std::lock_guard<spin_lock> lg(a.lock);
+                    take();
+                }
+                return result;
+            }
+
+            // must be called with the lock held
+            bool take() {
+                if (!a.accepted.empty()) {
+                    result = a.accepted.front();
+                    a.accepted.pop_front();
+                    return taken = true;
+                }
+                if (a.last_error != 0) {
+                    result = a.last_error;
+                    a.last_error = 0;
+                    return taken = true;
+                }
+                return false;
+            }
+        };
+
+        // returns the accepted fd or -errno
+        multishot_accept_awaiter accept() {
+            return multishot_accept_awaiter{ *this };
+        }
+    };
+
+    /*
+    A group of equally sized buffers provided to the kernel (IORING_OP_PROVIDE_BUFFERS).
+    Multishot receives pick a free buffer themselves; the buffer belongs to the
+    caller until it is handed back with recycle().
+    Provided buffer rings (IORING_REGISTER_PBUF_RING) would save the sqe per
+    recycle, but they are not honoured by every kernel that accepts them.
+    */
+    struct buffer_ring {
+        uint16_t group_id;
+        uint16_t count;
+        uint32_t buffer_size;
+        char* storage = nullptr;
+        buffer_ring(uint16_t group_id, uint16_t count, uint32_t buffer_size)
+            : group_id(group_id), count(count), buffer_size(buffer_size) {
+            auto uring = get_uring_awaiter();
+            if (uring == nullptr)
+                return;
+
+            storage = new char[(size_t)count * buffer_size];
+            if (!give(uring, 0, count)) {
+                delete[] storage;
+                storage = nullptr;
+            }
+        }
+
+        ~buffer_ring() {
+            if (storage == nullptr)
+                return;
+            // receivers filling this group must be gone by now, the kernel lets go of
+            // the storage once the removal completes
+            auto* req = new removal();
+            req->storage = storage;
+            bool submitted = get_uring_awaiter()->submit(req, [this](io_uring_sqe* sqe) {
+                sqe->opcode = IORING_OP_REMOVE_BUFFERS;
+                sqe->fd = count;
+                sqe->buf_group = group_id;
+            });
+            if (!submitted)
+                removal::on_complete(req, 0, 0);
+        }
+
+        buffer_ring(const buffer_ring&) = delete;
+        buffer_ring& operator=(const buffer_ring&) = delete;
+
+        bool valid() const {
+            return storage != nullptr;
+        }
+
+        char* data(uint16_t id) const {
+            return storage + (size_t)id * buffer_size;
+        }
+
+        void recycle(uint16_t id) {
+            give(get_uring_awaiter(), id, 1);
+        }
+
+    private:
+        // outlives the buffer_ring until IORING_OP_REMOVE_BUFFERS completes
+        struct removal : uring_request {
+            char* storage = nullptr;
+
+            removal() {
+                routine = &removal::on_complete;
+            }
+
+            static void on_complete(uring_request* self, int32_t, uint32_t) {
+                auto* r = static_cast<removal*>(self);
+                delete[] r->storage;
+                delete r;
+            }
+        };
+
+        bool give(uring_awaiter* uring, uint16_t first, uint16_t n) {
+            return uring->submit(nullptr, [this, first, n](io_uring_sqe* sqe) {
+                sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+                sqe->fd = n;
+                sqe->addr = (uint64_t)data(first);
+                sqe->len = buffer_size;
+                sqe->off = first;
+                sqe->buf_group = group_id;
+            });
+        }
+    };
+
+    /*
+    Keeps one multishot recv armed on a connected socket, filling buffers of a
+    buffer_ring. Each co_await recv() yields one chunk; hand it back with
+    buffers.recycle(chunk.buffer_id) once done with it.
+    A chunk with len <= 0 reports end of stream (0) or an error (-errno).
+    Destroying the receiver cancels the request.
+    */
+    struct multishot_receiver : uring_request {
+        struct chunk {
+            char* data;
+            int len;
+            uint16_t buffer_id;
+        };
+
+        int fd;
+        buffer_ring& buffers;
+        spin_lock lock;
+        std::deque<chunk> chunks;
+        coroutine_handle waiter = nullptr;
+        bool armed = false;
+        bool finished = false;
+
+        multishot_receiver(int fd, buffer_ring& buffers) : fd(fd), buffers(buffers) {
+            routine = &multishot_receiver::on_complete;
+        }
+
+        ~multishot_receiver() {
+            cancel_multishot(this, lock, armed);
+            for (auto& c : chunks) {
+                if (c.len > 0)
+                    buffers.recycle(c.buffer_id);
+            }
+        }
+
+        multishot_receiver(const multishot_receiver&) = delete;
+        multishot_receiver& operator=(const multishot_receiver&) = delete;
+
+        static void on_complete(uring_request* self, int32_t res, uint32_t flags) {
+            auto* r = static_cast<multishot_receiver*>(self);
+            coroutine_handle h = nullptr;
+            {
+                std::lock_guard<spin_lock> lg(r->lock);
+                if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+                    uint16_t id = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+                    r->chunks.push_back({ r->buffers.data(id), res, id });
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    r->armed = false;
+                    // out of buffers just means the consumer is behind, anything else ends the stream
+                    if (res != -ENOBUFS) {
+                        r->finished = true;
+                        if (res <= 0)
+                            r->chunks.push_back({ nullptr, res, 0 });
+                    }
+                }
+                std::swap(h, r->waiter);
+            }
+            if (h != nullptr)
+                go(h);
+        }
+
+        // Called without the lock, which the reactor needs to deliver completions.
+        bool arm() {
+            auto ring = get_uring_awaiter();
+            return ring != nullptr && buffers.valid() && ring->submit(this, [this](io_uring_sqe* sqe) {
+                sqe->opcode = IORING_OP_RECV;
+                sqe->fd = fd;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = buffers.group_id;
+            });
+        }
+
+        struct multishot_recv_awaiter {
+            multishot_receiver& r;
+            chunk result = { nullptr, -ENOSYS, 0 };
+            bool taken = false;
+
+            bool await_ready() {
+                std::lock_guard<spin_lock> lg(r.lock);
+                return take();
+            }
+
+            bool await_suspend(root_handle h) {
+                bool arming;
+                {
+                    std::lock_guard<spin_lock> lg(r.lock);
+                    if (take())
+                        return false;
+                    if (r.finished) {
+                        result = { nullptr, 0, 0 };
+                        return false;
+                    }
+                    r.waiter = h;
+                    arming = !r.armed;
+                    r.armed = true;
+                }
+                if (arming && !r.arm()) {
+                    std::lock_guard<spin_lock> lg(r.lock);
+                    r.armed = false;
+                    r.waiter = nullptr;
+                    return false;
+                }
+                park(h, "recv");
+                return true;
+            }
+
+            chunk await_resume() {
+                if (!taken) {
+                    std::lock_guard<spin_lock> lg(r.lock);
+                    take();
+                }
+                return result;
+            }
+
+            // must be called with the lock held
+            bool take() {
+                if (r.chunks.empty())
+                    return false;
+                result = r.chunks.front();
+                r.chunks.pop_front();
+                return taken = true;
+            }
+        };
+
+        multishot_recv_awaiter recv() {
+            return multishot_recv_awaiter{ *this };
+        }
+    };
+}
+
+#endif
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef _CORO_LOG_H_
+#define _CORO_LOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+
+/*
+Leveled logging of the library. CORO_LOG(level, format, args...) takes a printf
+format, which must outlive the program like a string literal does, and up to
+details::max_args numbers, pointers or strings. Statements below CORO_LOG_LEVEL
+are discarded at compile time, arguments included. The default is info with
+NDEBUG and debug without, so trace only exists with -DCORO_LOG_LEVEL=0.
+
+A statement that is compiled in checks the level of set_level() and copies its
+arguments, strings included, to a ring of the calling thread. That takes no
+lock, and the record is dropped when the ring is full. A background thread
+formats the records and hands the lines to the sink, stderr unless set_sink()
+says otherwise. It sleeps until a ring is half full or a warning or error comes
+in, and drains everything once more when the program exits; flush() does the
+same right away.
+*/
+#ifndef CORO_LOG_LEVEL
+#ifdef NDEBUG
+#define CORO_LOG_LEVEL 2
+#else
+#define CORO_LOG_LEVEL 1
+#endif
+#endif
+
+#define CORO_LOG(lvl, ...) \
+	do { \
+		if constexpr (coro::log::compiled_in(coro::log::level::lvl)) \
+			coro::log::details::push(coro::log::level::lvl, __VA_ARGS__); \
+	} while (0)
+
+namespace coro::log {
+
+	enum class level {
+		trace,
+		debug,
+		info,
+		warn,
+		error,
+		off,
+	};
+
+	constexpr level compiled_level = (level)CORO_LOG_LEVEL;
+
+	constexpr bool compiled_in(level l) {
+		return l >= compiled_level && l != level::off;
+	}
+
+	// gets one formatted line without the newline, never two calls at once
+	using sink = void (*)(level l, const char* line);
+
+	// Records below l are dropped before they are queued; everything compiled in by default.
+	void set_level(level l);
+
+	// nullptr goes back to stderr
+	void set_sink(sink s);
+
+	// Formats what every thread queued so far and waits for the sink to take it.
+	void flush();
+
+	// records lost to a full ring
+	uint64_t dropped();
+
+	const char* name_of(level l);
+
+	namespace details {
+		constexpr size_t max_args = 6;
+		// room for the strings of one record, longer ones are cut
+		constexpr size_t text_size = 64;
+
+		union value {
+			uint64_t i;
+			double d;
+			const void* p;
+		};
+
+		struct record {
+			uint64_t time_ns;
+			const char* format;
+			level lvl;
+			uint8_t arg_count;
+			uint8_t text_used;
+			value args[max_args];
+			char text[text_size];
+		};
+
+		// Written by its thread only, read by whoever formats under the registry lock.
+		struct ring {
+			static constexpr size_t capacity = 256;
+			// fill at which the background thread is woken
+			static constexpr size_t wake_at = capacity / 2;
+
+			std::atomic<uint64_t> head = 0;
+			std::atomic<uint64_t> tail = 0;
+			record records[capacity];
+			// set when its thread exited, freed once drained
+			std::atomic<bool> retired = false;
+			size_t thread_index = 0;
+			ring* next = nullptr;
+		};
+
+		ring* acquire_ring();
+
+		// wakes the background thread, for records that should not wait for its next round
+		void notify();
+
+		struct thread_ring {
+			ring* r = nullptr;
+
+			~thread_ring() {
+				if (r != nullptr)
+					r->retired.store(true, std::memory_order_release);
+				r = nullptr;
+			}
+		};
+
+		inline thread_local thread_ring tls_ring;
+		inline std::atomic<level> runtime_level = level::trace;
+		inline std::atomic<uint64_t> dropped_count = 0;
+
+		template<typename T>
+		void store(record& r, value& v, T a) {
+			if constexpr (std::is_floating_point_v<T>) {
+				v.d = (double)a;
+			}
+			else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+				v.i = (uint64_t)a;
+			}
+			else if constexpr (std::is_convertible_v<T, const char*>) {
+				// the offset of the copy in text
+				const char* s = a != nullptr ? (const char*)a : "(null)";
+				v.i = r.text_used;
+				size_t n = r.text_used;
+				while (*s != 0 && n + 1 < text_size)
+					r.text[n++] = *s++;
+				r.text[n] = 0;
+				r.text_used = (uint8_t)(n + 1 < text_size ? n + 1 : n);
+			}
+			else {
+				v.p = (const void*)a;
+			}
+		}
+
+		template<typename... Args>
+		void push(level l, const char* format, Args... args) {
+			static_assert(sizeof...(Args) <= max_args, "too many arguments for CORO_LOG");
+			if (l < runtime_level.load(std::memory_order_relaxed))
+				return;
+			auto& local = tls_ring;
+			if (local.r == nullptr)
+				local.r = acquire_ring();
+			ring& q = *local.r;
+			uint64_t t = q.tail.load(std::memory_order_relaxed);
+			uint64_t h = q.head.load(std::memory_order_acquire);
+			if (t - h >= ring::capacity) {
+				dropped_count.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			record& r = q.records[t % ring::capacity];
+			r.time_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			r.format = format;
+			r.lvl = l;
+			r.arg_count = (uint8_t)sizeof...(Args);
+			r.text_used = 0;
+			r.text[0] = 0;
+			size_t i = 0;
+			(store(r, r.args[i++], args), ...);
+			q.tail.store(t + 1, std::memory_order_release);
+			// the fill grows by one per record, so it passes wake_at exactly once on its way up
+			if (l >= level::warn || t + 1 - h == ring::wake_at)
+				notify();
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef _CORO_METRICS_H_
+#define _CORO_METRICS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <vector>
+
+namespace coro::metrics {
+
+	/*
+	Counters and histograms of the scheduler and of coro::net. Every thread
+	records into a block of its own, which only it writes, with relaxed stores;
+	snapshot() sums the blocks up, including those of threads that exited.
+
+	Define CORO_METRICS (cmake -DLIBCORO_METRICS=ON) for the whole build to
+	record them. Without it the hooks in details are empty, the clock is never
+	read and snapshot() does not exist.
+	*/
+
+	enum class event {
+		// a task2 started by go()
+		spawned,
+		// a turn of a task on a worker
+		resumed,
+		// a task2 that ran to completion
+		destroyed,
+		// a task that got off its worker waiting for go()
+		parked,
+		// a task taken from the queue of another worker
+		stolen,
+		// a worker that found nothing to do and went to sleep
+		worker_parked,
+		// epoll_wait or io_uring_enter returned to a reactor
+		reactor_wakeup,
+	};
+
+	constexpr size_t event_count = 7;
+
+	enum class series {
+		// from go() to the worker resuming the task, in nanoseconds; one wakeup in queue_sample_rate
+		queue_ns,
+		// events of one epoll_wait, completions of one io_uring_enter
+		reactor_batch,
+		// from calling coro::net::recv/send to its result, in nanoseconds
+		recv_ns,
+		send_ns,
+	};
+
+	constexpr size_t series_count = 4;
+
+	// reading the clock twice for every wakeup would cost more than the rest of it
+	constexpr size_t queue_sample_rate = 16;
+
+	// Bucket 0 counts zeros, bucket i the values in [2^(i-1), 2^i).
+	struct histogram {
+		static constexpr size_t bucket_count = 40;
+
+		uint64_t buckets[bucket_count] = {};
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t max = 0;
+
+		static size_t bucket_of(uint64_t value) {
+			return std::min<size_t>(std::bit_width(value), bucket_count - 1);
+		}
+
+		double mean() const {
+			return count == 0 ? 0.0 : (double)sum / (double)count;
+		}
+
+		// upper bound of the bucket the q-quantile falls in, never above max
+		uint64_t quantile(double q) const {
+			uint64_t rank = (uint64_t)(q * (double)count);
+			uint64_t seen = 0;
+			for (size_t i = 0; i < bucket_count; i++) {
+				seen += buckets[i];
+				if (seen > rank)
+					return std::min<uint64_t>(i == 0 ? 0 : (uint64_t(1) << i) - 1, max);
+			}
+			return max;
+		}
+
+		void merge(const histogram& other) {
+			for (size_t i = 0; i < bucket_count; i++)
+				buckets[i] += other.buckets[i];
+			count += other.count;
+			sum += other.sum;
+			max = std::max(max, other.max);
+		}
+	};
+
+	struct counters {
+		uint64_t events[event_count] = {};
+		histogram histograms[series_count];
+
+		uint64_t operator[](event e) const {
+			return events[(size_t)e];
+		}
+
+		const histogram& operator[](series s) const {
+			return histograms[(size_t)s];
+		}
+
+		void merge(const counters& other) {
+			for (size_t i = 0; i < event_count; i++)
+				events[i] += other.events[i];
+			for (size_t i = 0; i < series_count; i++)
+				histograms[i].merge(other.histograms[i]);
+		}
+	};
+
+	struct stats {
+		// every thread, the ones that exited included
+		counters total;
+		// the workers of the default executor by index, while it runs
+		std::vector<counters> workers;
+		// tasks queued on the default executor
+		size_t ready = 0;
+		// spawned and not destroyed yet; those that are not ready run or are parked
+		uint64_t alive = 0;
+	};
+
+	namespace details {
+#ifdef CORO_METRICS
+		// only the owning thread writes, so no read-modify-write is needed
+		inline void bump(std::atomic<uint64_t>& v, uint64_t by = 1) {
+			v.store(v.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+		}
+
+		struct atomic_histogram {
+			std::atomic<uint64_t> buckets[histogram::bucket_count] = {};
+			std::atomic<uint64_t> count = 0;
+			std::atomic<uint64_t> sum = 0;
+			std::atomic<uint64_t> max = 0;
+
+			void record(uint64_t value) {
+				bump(buckets[histogram::bucket_of(value)]);
+				bump(count);
+				bump(sum, value);
+				if (value > max.load(std::memory_order_relaxed))
+					max.store(value, std::memory_order_relaxed);
+			}
+
+			void read(histogram& h) const {
+				for (size_t i = 0; i < histogram::bucket_count; i++)
+					h.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+				h.count = count.load(std::memory_order_relaxed);
+				h.sum = sum.load(std::memory_order_relaxed);
+				h.max = max.load(std::memory_order_relaxed);
+			}
+		};
+
+		struct thread_block {
+			std::atomic<uint64_t> events[event_count] = {};
+			atomic_histogram histograms[series_count];
+			// index among the workers of the default executor, SIZE_MAX on any other thread
+			std::atomic<size_t> worker = SIZE_MAX;
+			// wakeups made on this thread, see queue_sample_rate
+			size_t wakeups = 0;
+
+			thread_block* next_block = nullptr;
+			thread_block* prev_block = nullptr;
+
+			thread_block();
+			~thread_block();
+
+			counters read() const {
+				counters c;
+				for (size_t i = 0; i < event_count; i++)
+					c.events[i] = events[i].load(std::memory_order_relaxed);
+				for (size_t i = 0; i < series_count; i++)
+					histograms[i].read(c.histograms[i]);
+				return c;
+			}
+		};
+
+		inline thread_local thread_block tls_block;
+
+		inline void count(event e) {
+			bump(tls_block.events[(size_t)e]);
+		}
+
+		inline void record(series s, uint64_t value) {
+			tls_block.histograms[(size_t)s].record(value);
+		}
+
+		inline uint64_t now_ns() {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// 0 for the wakeups that are not sampled
+		inline uint64_t sample_ready() {
+			return ++tls_block.wakeups % queue_sample_rate == 0 ? now_ns() : 0;
+		}
+
+		inline void set_worker(size_t index) {
+			tls_block.worker.store(index, std::memory_order_relaxed);
+		}
+#else
+		inline void count(event) {}
+		inline void record(series, uint64_t) {}
+		inline uint64_t now_ns() { return 0; }
+		inline void set_worker(size_t) {}
+#endif
+
+		// Times one operation into a series, from construction to stop().
+		struct stopwatch {
+#ifdef CORO_METRICS
+			uint64_t start = now_ns();
+#endif
+
+			void stop([[maybe_unused]] series s) const {
+#ifdef CORO_METRICS
+				record(s, now_ns() - start);
+#endif
+			}
+		};
+	}
+
+#ifdef CORO_METRICS
+	stats snapshot();
+#endif
+}
+
+#endif
@@ -6,20 +6,84 @@
 #include <mutex>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <span>
+#include <string>
+#include <string_view>
+#include "frame_pool.hpp"
+#include "cancellation.hpp"
+#include "metrics.hpp"
 
 namespace coro {
 
 	enum class task_status {
 		created,
 		ready,
+		running,
+		// park() was called while the coroutine is still on its worker
+		parking,
+		// go() was called while the coroutine is still on its worker
+		notified,
 		suspend,
 		done,
 	};
 
+	// High priority tasks run ahead of every normal one that is ready. They are meant
+	// for short latency-sensitive work and starve the rest if they never suspend.
+	enum class task_priority {
+		normal,
+		high,
+	};
+
+	enum class schedule_policy {
+		// a woken task queues behind the ones that are ready on its worker already
+		fifo,
+		// a task woken on a worker runs next on it, while what it woke up for is still in cache
+		lifo_slot,
+	};
+
+	enum class worker_affinity {
+		// the OS moves the workers wherever it likes
+		none,
+		// worker i is pinned to the i-th CPU the process may use
+		core,
+		// worker i may use every CPU of the NUMA node of that CPU
+		numa_node,
+	};
+
+	/*
+	Pinned workers are grouped into NUMA domains by the node of their first CPU.
+	They steal from their own domain before anything else and from the others
+	only when there is nothing left, and the reactor paired with a worker runs
+	on its CPUs. Frame caches are per thread, so a pinned worker allocates from
+	its own node. Pinning is only implemented on Linux.
+	*/
+	struct scheduler_options {
+		schedule_policy policy = schedule_policy::lifo_slot;
+		// 0 starts one worker per hardware thread
+		size_t worker_count = 0;
+		worker_affinity affinity = worker_affinity::none;
+		// CPUs of worker i are cpu_sets[i % cpu_sets.size()]; given, it takes precedence over affinity
+		std::vector<std::vector<int>> cpu_sets;
+	};
+
+	struct resume_guard;
+
+	// A pool of workers with a run queue of its own, see make_executor().
+	struct executor;
+
 	struct task2 {
 		struct promise_type {
 			promise_type() {}
 
+			static void* operator new(std::size_t size) {
+				return allocate_frame(size);
+			}
+
+			static void operator delete(void* p, std::size_t size) {
+				deallocate_frame(p, size);
+			}
+
 			task2 get_return_object() {
 				return task2{
 					std::coroutine_handle<promise_type>::from_promise(*this)
@@ -34,7 +98,7 @@ namespace coro {
 				constexpr bool await_ready() const noexcept { return false; }
 				
 				bool await_suspend(std::coroutine_handle<promise_type> handle) const noexcept {
-					handle.promise().status = task_status::done;
+					handle.promise().status.store(task_status::done);
 					return true;
 				}
 				
@@ -49,8 +113,35 @@ namespace coro {
 
 			void return_void() {}
 
-			task_status status = task_status::created;
+			std::atomic<task_status> status = task_status::created;
+
+			// the innermost awaited task, which is what the scheduler resumes.
+			// null while this coroutine itself is the one suspended.
+			std::coroutine_handle<> leaf = nullptr;
+			// set when a task in the chain handed control to another one,
+			// the worker then resumes the new leaf right away
+			bool transfer = false;
+
+			// watched by the awaiters this task suspends in, inherited by the tasks it spawns
+			cancellation_token cancel_token;
+
+			// run by the worker before it resumes the task, see resume_guard
+			resume_guard* guard = nullptr;
 
+			// kept for every wakeup, not inherited by the tasks it spawns
+			task_priority priority = task_priority::normal;
+
+			// where the task runs, inherited by the tasks it spawns; null is the default executor
+			executor* exec = nullptr;
+
+#ifdef CORO_METRICS
+			// when the task was made ready last if that wakeup is sampled, see metrics::series::queue_ns
+			uint64_t ready_since = 0;
+#endif
+#ifdef CORO_TRACING
+			// given when the task is spawned, names it in the trace
+			uint64_t trace_id = 0;
+#endif
 		};
 
 		using handle_type = std::coroutine_handle<promise_type>;
@@ -79,16 +170,126 @@ namespace coro {
 
 	using coroutine_handle = task2::handle_type;
 
+	/*
+	Set in the promise by whoever wakes a task that still has to check something
+	before it may run. The worker calls the routine instead of resuming the task,
+	the routine clears the guard and returns false if it parked the task again
+	rather than letting it run (see mutex_mode::barging).
+	*/
+	struct resume_guard {
+		bool (*routine)(resume_guard* self, coroutine_handle handle) = nullptr;
+	};
+
+	inline coroutine_handle root_of(coroutine_handle handle) {
+		return handle;
+	}
+
+	// Awaited tasks (see task.hpp) keep a pointer to the task2 that is actually scheduled.
+	template<typename Promise>
+	coroutine_handle root_of(std::coroutine_handle<Promise> handle) {
+		return handle.promise().root;
+	}
+
+	// Parameter type of await_suspend for every awaiter of this library,
+	// so they can be awaited from a task2 as well as from any task<T> it awaits.
+	struct root_handle {
+		coroutine_handle handle;
+
+		template<typename Promise>
+		root_handle(std::coroutine_handle<Promise> h) : handle(root_of(h)) {}
+
+		operator coroutine_handle() const { return handle; }
+
+		auto& promise() const noexcept { return handle.promise(); }
+	};
+
+	struct executor_options {
+		// for find_executor()
+		std::string name;
+		size_t threads = 1;
+		// niceness of the worker threads on Linux, higher runs less often
+		int nice = 0;
+		schedule_policy policy = schedule_policy::lifo_slot;
+		// see scheduler_options
+		worker_affinity affinity = worker_affinity::none;
+		std::vector<std::vector<int>> cpu_sets;
+	};
+
+	// Starts the workers of a new executor, which keeps running until the main coroutine is done.
+	// CPU-bound work kept on an executor of its own cannot starve the I/O handlers of the default one.
+	executor* make_executor(executor_options options);
+
+	// nullptr if there is none of that name
+	executor* find_executor(std::string_view name);
+
+	// The executor start_main_coroutine() runs, named "default".
+	executor* default_executor();
+
+	// Executor of the worker the caller runs on, nullptr on any other thread.
+	executor* current_executor();
+
+	// co_await switch_to(ex) resumes the task on a worker of ex, and it stays there
+	struct switch_to {
+		executor* target;
+
+		explicit switch_to(executor* target) : target(target) {}
+
+		bool await_ready() const {
+			return current_executor() == target;
+		}
+
+		// suspends like yield(); the worker sees the new executor and queues the task over there
+		bool await_suspend(root_handle h) {
+			h.promise().exec = target;
+			return true;
+		}
+
+		void await_resume() const {}
+	};
+
 	struct thread_awaiter {
 		virtual void wait(std::vector<coroutine_handle>& handles) = 0;
 		virtual bool should_suspend() const = 0;
 	};
 
-	void park(coroutine_handle handle);
+	// reason says what the task waits for, as a string literal; it names the wait in the trace, see tracing.hpp
+	void park(coroutine_handle handle, const char* reason = nullptr);
 
 	void go(coroutine_handle handle);
+
+	// Starts a created task with its own token instead of the one of the task calling go().
+	void go(coroutine_handle handle, cancellation_token token);
+
+	// Starts a created task with the given priority.
+	void go(coroutine_handle handle, task_priority priority);
+
+	// Starts a created task on ex rather than on the executor of the task calling go().
+	void go(coroutine_handle handle, executor* ex);
+
+	// go() on every handle, with one trip through the scheduler for all that became ready.
+	// The span is overwritten with those.
+	void go(std::span<coroutine_handle> handles);
+
+	// While set, go() on the calling thread appends the tasks it makes ready to handles instead of
+	// scheduling them, so a reactor hands a whole batch of wakeups over at once. nullptr ends it.
+	void collect_wakeups(std::vector<coroutine_handle>* handles);
+
+	// Token of the task running on the calling thread, the default token anywhere else.
+	cancellation_token current_cancellation_token();
 	
-	void start_main_coroutine(coroutine_handle main_handle);
+	void start_main_coroutine(coroutine_handle main_handle, scheduler_options options = {});
+
+	// Number of worker threads of the running scheduler, 0 before it is started.
+	size_t worker_count();
+
+	// Index of the worker the caller runs on, SIZE_MAX on any other thread.
+	size_t current_worker_index();
+
+	// Coroutines woken from the calling thread, which must not be a worker, are queued
+	// to worker `index % worker_count()` rather than to the global queue.
+	// Reactor threads use this to keep the coroutines of their sockets on one worker.
+	// The thread is pinned to the CPUs of that worker, if it has any.
+	void set_home_worker(size_t index);
 	
 }
 
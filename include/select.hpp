@@ -0,0 +1,421 @@
+#ifndef _CORO_SELECT_H_
+#define _CORO_SELECT_H_
+
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <timer.hpp>
+#include <tuple>
+#include <type_traits>
+
+#ifdef __linux__
+#include <linux_epoll.hpp>
+#include <poll.h>
+#endif
+
+namespace coro {
+	namespace details {
+		/*
+		Shared by the cases of one select. Every case that fires claims the select,
+		the first claim wins and resumes the coroutine, the later ones are dropped.
+		*/
+		struct select_state {
+			static constexpr size_t none = SIZE_MAX;
+
+			coroutine_handle handle = nullptr;
+			std::atomic<size_t> winner = none;
+			// cases whose routine called fire() and is done with the state
+			std::atomic<size_t> settled = 0;
+			// the armed condition_variable case; the coroutine then only resumes once that waiter holds the mutex again
+			condition_variable::condition_variable_waiter* relock = nullptr;
+
+			bool fired() const {
+				return winner.load(std::memory_order_acquire) != none;
+			}
+
+			bool claim(size_t index) {
+				size_t expected = none;
+				return winner.compare_exchange_strong(expected, index, std::memory_order_acq_rel);
+			}
+
+			// Called exactly once by every case that fired, from whatever thread saw it fire.
+			void fire(size_t index) {
+				if (claim(index))
+					resume();
+				// the state may be gone right after this
+				settled.fetch_add(1, std::memory_order_release);
+			}
+
+			void resume() {
+				if (relock == nullptr) {
+					go(handle);
+					return;
+				}
+				// a notified waiter already queues for the mutex, and its grant resumes us
+				condition_variable::condition_variable_waiter* w = relock;
+				{
+					std::lock_guard<spin_lock> lg(w->cv.slock);
+					if (!w->waiting)
+						return;
+					w->cv.waiters.remove(w);
+					w->waiting = false;
+				}
+				condition_variable::wakeup(w);
+			}
+		};
+
+		struct select_case_base {
+			select_state* state = nullptr;
+			size_t index = 0;
+			// registered by arm(), so await_resume() has to withdraw it
+			bool armed = false;
+			// the case that hands the mutex back (see select_state::relock)
+			static constexpr bool relocks = false;
+		};
+
+		/*
+		Adapts one awaiter type to select(). A case provides
+		- ready(): it can fire without waiting
+		- arm(): registers it; returns false if it fired right away instead
+		- withdraw(): takes the registration back; returns false if the case fired
+		  or is firing, in which case state->fire() is (still) called exactly once
+		Only the awaiters specialized below can be selected on.
+		*/
+		template<typename _Awaiter>
+		struct select_case;
+
+		template<>
+		struct select_case<wait_group::wg_awaiter> : select_case_base {
+			struct node_t : wait_node {
+				select_case* owner;
+			};
+
+			wait_group& wg;
+			node_t node;
+
+			select_case(wait_group::wg_awaiter& a) : wg(a.wg) {}
+
+			static void on_done(wait_node* self) {
+				select_case* c = static_cast<node_t*>(self)->owner;
+				c->state->fire(c->index);
+			}
+
+			bool ready() {
+				return wg.finished();
+			}
+
+			bool arm() {
+				node.owner = this;
+				node.handle = state->handle;
+				node.notify = &select_case::on_done;
+				std::lock_guard<spin_lock> lg(wg.lock);
+				if (wg.expect_count == 0)
+					return false;
+				wg.waiters.push_back(&node);
+				return true;
+			}
+
+			bool withdraw() {
+				// done() wakes the node with the lock held, so once it is unlinked its routine has returned
+				std::lock_guard<spin_lock> lg(wg.lock);
+				if (!wait_list::linked(&node))
+					return false;
+				wg.waiters.remove(&node);
+				return true;
+			}
+		};
+
+		// Waits like cv.wait(mtx): mtx must be held, and it is held again when the select resumes, whichever case fired.
+		template<>
+		struct select_case<condition_variable::condition_variable_waiter> : select_case_base {
+			static constexpr bool relocks = true;
+
+			struct node_t : condition_variable::condition_variable_waiter {
+				using condition_variable::condition_variable_waiter::condition_variable_waiter;
+				select_case* owner = nullptr;
+			};
+
+			node_t node;
+
+			select_case(condition_variable::condition_variable_waiter& a) : node(a.cv, a.mtx) {}
+
+			// the mutex was granted, the coroutine resumes whether this case won or not
+			static void on_relocked(wait_node* self) {
+				select_case* c = static_cast<node_t*>(static_cast<condition_variable::condition_variable_waiter*>(self))->owner;
+				c->state->claim(c->index);
+				go(c->state->handle);
+			}
+
+			bool ready() {
+				return false;
+			}
+
+			bool arm() {
+				node.owner = this;
+				node.handle = state->handle;
+				node.notify = &select_case::on_relocked;
+				state->relock = &node;
+				std::lock_guard<spin_lock> lg(node.cv.slock);
+				node.cv.waiters.push_back(&node);
+				node.waiting = true;
+				node.mtx.unlock();
+				return true;
+			}
+
+			// never calls fire(), and whatever resumed the coroutine is done with the node
+			bool withdraw() {
+				return true;
+			}
+		};
+
+		template<>
+		struct select_case<sleep_awaiter> : select_case_base {
+			struct node_t : timer_node {
+				select_case* owner;
+			};
+
+			node_t node;
+			bool always_suspend;
+
+			select_case(sleep_awaiter& a) : always_suspend(a.always_suspend) {
+				node.deadline = a.deadline;
+			}
+
+			static void on_timer(timer_node* self) {
+				select_case* c = static_cast<node_t*>(self)->owner;
+				c->state->fire(c->index);
+			}
+
+			bool ready() {
+				return !always_suspend && node.deadline <= now_tick();
+			}
+
+			bool arm() {
+				node.owner = this;
+				node.routine = &select_case::on_timer;
+				add_timer(&node);
+				return true;
+			}
+
+			bool withdraw() {
+				return cancel_timer(&node);
+			}
+		};
+
+#ifdef __linux__
+		/*
+		Fires once the socket is readable: recv() has data or the end of the stream,
+		accept() has a connection. The operation itself is not run, awaiting it
+		afterwards completes without waiting.
+		*/
+		struct select_readable : select_case_base, linux_epoll::epoll_operation {
+			int fd;
+			linux_epoll::epoll_registration* reg = nullptr;
+#ifdef CORO_USE_IO_URING
+			struct poll_request : linux_uring::uring_request {
+				select_readable* owner;
+			};
+
+			bool uring;
+			bool submitted = false;
+			std::atomic<bool> completed = false;
+			poll_request poll;
+
+			select_readable(int fd, bool uring) : fd(fd), uring(uring) {}
+
+			static void on_polled(linux_uring::uring_request* self, int32_t, uint32_t) {
+				select_readable* c = static_cast<poll_request*>(self)->owner;
+				c->completed.store(true, std::memory_order_release);
+				c->state->fire(c->index);
+			}
+#else
+			select_readable(int fd) : fd(fd) {}
+#endif
+
+			linux_epoll::io_attempt readable() {
+				pollfd p = { fd, POLLIN, 0 };
+				return ::poll(&p, 1, 0) == 0 ? linux_epoll::io_attempt::blocked : linux_epoll::io_attempt::done;
+			}
+
+			static void on_event(linux_epoll::epoll_operation* self, uint32_t, int err) {
+				select_readable* c = static_cast<select_readable*>(self);
+				if (err == 0 && !c->state->fired() && c->reg->arm(c->reg->reader, c, [c]() { return c->readable(); }, err)) {
+					// parked again; if another case won meanwhile, take it back out unless withdraw() did
+					if (!c->state->fired())
+						return;
+					uintptr_t expected = (uintptr_t)static_cast<linux_epoll::epoll_operation*>(c);
+					if (!c->reg->reader.compare_exchange_strong(expected, linux_epoll::epoll_registration::idle, std::memory_order_acq_rel))
+						return;
+				}
+				c->state->fire(c->index);
+			}
+
+			bool ready() {
+				return false;
+			}
+
+			bool arm() {
+#ifdef CORO_USE_IO_URING
+				if (uring) {
+					poll.owner = this;
+					poll.routine = &select_readable::on_polled;
+					auto ring = linux_uring::get_uring_awaiter();
+					submitted = ring != nullptr && ring->submit(&poll, [this](io_uring_sqe* sqe) {
+						sqe->opcode = IORING_OP_POLL_ADD;
+						sqe->fd = fd;
+						sqe->poll32_events = POLLIN;
+					});
+					return submitted;
+				}
+#endif
+				routine = &select_readable::on_event;
+				reg = linux_epoll::get_epoll_reactors()->registration(fd);
+				if (reg == nullptr)
+					return false;
+				// a failure fires the case, the operation then reports it
+				int error;
+				return reg->arm(reg->reader, this, [this]() { return readable(); }, error);
+			}
+
+			bool withdraw() {
+#ifdef CORO_USE_IO_URING
+				if (uring) {
+					// the poll completes either way, with -ECANCELED if the cancel got it first
+					if (submitted && !completed.load(std::memory_order_acquire)) {
+						linux_uring::get_uring_awaiter()->submit(nullptr, [this](io_uring_sqe* sqe) {
+							sqe->opcode = IORING_OP_ASYNC_CANCEL;
+							sqe->addr = (uint64_t)(linux_uring::uring_request*)&poll;
+						});
+					}
+					return false;
+				}
+#endif
+				if (reg == nullptr)
+					return false;
+				uintptr_t expected = (uintptr_t)static_cast<linux_epoll::epoll_operation*>(this);
+				return reg->reader.compare_exchange_strong(expected, linux_epoll::epoll_registration::idle, std::memory_order_acq_rel);
+			}
+		};
+
+#ifdef CORO_USE_IO_URING
+		template<>
+		struct select_case<net::epoll_recv_awaiter> : select_readable {
+			select_case(net::epoll_recv_awaiter& a) : select_readable(a.fd, false) {}
+		};
+
+		template<>
+		struct select_case<net::epoll_accept_awaiter> : select_readable {
+			select_case(net::epoll_accept_awaiter& a) : select_readable(a.fd, false) {}
+		};
+
+		template<>
+		struct select_case<net::recv_awaiter> : select_readable {
+			select_case(net::recv_awaiter& a)
+				: select_readable(a.impl.index() == 0 ? std::get<0>(a.impl).fd : std::get<1>(a.impl).prep.fd, a.impl.index() == 1) {}
+		};
+
+		template<>
+		struct select_case<net::accept_awaiter> : select_readable {
+			select_case(net::accept_awaiter& a)
+				: select_readable(a.impl.index() == 0 ? std::get<0>(a.impl).fd : std::get<1>(a.impl).prep.fd, a.impl.index() == 1) {}
+		};
+#else
+		template<>
+		struct select_case<net::epoll_recv_awaiter> : select_readable {
+			select_case(net::epoll_recv_awaiter& a) : select_readable(a.fd) {}
+		};
+
+		template<>
+		struct select_case<net::epoll_accept_awaiter> : select_readable {
+			select_case(net::epoll_accept_awaiter& a) : select_readable(a.fd) {}
+		};
+#endif
+#endif
+	}
+
+	/*
+	co_await select(a, b, ...) waits until the first of the given awaiters is
+	ready and returns its index; the others are withdrawn before it returns.
+	Supported are wait_group::wait(), condition_variable::wait(), sleep_for()
+	and friends as the deadline, and coro::net::recv()/accept(). A case fires
+	as its awaiter would complete, except for the sockets, which fire once
+	readable (see details::select_readable). At most one condition_variable
+	case is allowed; like cv.wait(mtx), the select then returns with mtx
+	locked, whichever case fired, and a notification it took without winning
+	is not passed on, so the caller has to check its condition again.
+	The awaiters only describe what to wait for and are not awaited themselves.
+	*/
+	template<typename... _Awaiters>
+	struct select_awaiter {
+		static_assert(sizeof...(_Awaiters) > 0, "select needs at least one case");
+		static_assert((0 + ... + (int)details::select_case<_Awaiters>::relocks) <= 1, "select takes at most one condition_variable case");
+
+		details::select_state state;
+		std::tuple<details::select_case<_Awaiters>...> cases;
+
+		select_awaiter(_Awaiters&... awaiters) : cases(awaiters...) {
+			size_t index = 0;
+			for_each([&](details::select_case_base& c) {
+				c.state = &state;
+				c.index = index++;
+			});
+		}
+
+		select_awaiter(const select_awaiter&) = delete;
+		select_awaiter& operator=(const select_awaiter&) = delete;
+
+		template<typename _Fn>
+		void for_each(_Fn&& fn) {
+			std::apply([&](auto&... c) { (fn(c), ...); }, cases);
+		}
+
+		bool await_ready() {
+			for_each([this](auto& c) {
+				if (!state.fired() && c.ready())
+					state.claim(c.index);
+			});
+			return state.fired();
+		}
+
+		bool await_suspend(root_handle h) {
+			state.handle = h;
+			park(h, "select");
+			// the condition_variable case goes first, so the one that wins always finds it to hand the mutex back
+			auto arm = [this](auto& c) {
+				if (state.fired())
+					return;
+				c.armed = true;
+				if (!c.arm())
+					state.fire(c.index);
+			};
+			for_each([&](auto& c) {
+				if constexpr (std::remove_reference_t<decltype(c)>::relocks)
+					arm(c);
+			});
+			for_each([&](auto& c) {
+				if constexpr (!std::remove_reference_t<decltype(c)>::relocks)
+					arm(c);
+			});
+			return true;
+		}
+
+		size_t await_resume() {
+			size_t expected = 0;
+			for_each([&](auto& c) {
+				if (c.armed && !c.withdraw())
+					expected++;
+			});
+			// a case that fired may still be on its way out of fire()
+			while (state.settled.load(std::memory_order_acquire) != expected) {
+				std::this_thread::yield();
+			}
+			return state.winner.load(std::memory_order_acquire);
+		}
+	};
+
+	template<typename... _Awaiters>
+	select_awaiter<std::remove_reference_t<_Awaiters>...> select(_Awaiters&&... awaiters) {
+		return select_awaiter<std::remove_reference_t<_Awaiters>...>(awaiters...);
+	}
+}
+
+#endif
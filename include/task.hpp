@@ -0,0 +1,168 @@
+#ifndef _CORO_TASK_H_
+#define _CORO_TASK_H_
+
+#include <coroutine>
+#include <exception>
+#include <variant>
+#include <utility>
+#include "scheduler.hpp"
+
+namespace coro {
+
+	/*
+	A lazily started child coroutine that produces a T.
+
+	co_await on a task<T> does not go through the scheduler: the awaiting coroutine
+	transfers control into the child, and the child transfers back to it from
+	final_suspend, so call chains run inline on the current worker.
+	While the child runs, the task2 at the bottom of the chain is the one that the
+	scheduler parks and resumes; its promise keeps the innermost child as `leaf`.
+
+	The transfer is done by the worker loop rather than by returning a handle from
+	await_suspend: compilers only turn the latter into a tail call when optimizing,
+	and a loop of co_await would otherwise grow the stack in debug builds.
+	*/
+	template<typename T = void>
+	struct task;
+
+	namespace details {
+		struct task_promise_base {
+			coroutine_handle root = nullptr;
+			std::coroutine_handle<> continuation = nullptr;
+			std::exception_ptr exception;
+
+			static void* operator new(std::size_t size) {
+				return allocate_frame(size);
+			}
+
+			static void operator delete(void* p, std::size_t size) {
+				deallocate_frame(p, size);
+			}
+
+			auto initial_suspend() noexcept {
+				return std::suspend_always{};
+			}
+
+			struct task_final_suspend {
+				constexpr bool await_ready() const noexcept { return false; }
+
+				template<typename Promise>
+				void await_suspend(std::coroutine_handle<Promise> handle) const noexcept {
+					auto& promise = handle.promise();
+					auto& root = promise.root.promise();
+					// the root itself is resumed directly by the scheduler
+					root.leaf = promise.continuation == promise.root ? nullptr : promise.continuation;
+					root.transfer = true;
+				}
+
+				constexpr void await_resume() const noexcept {}
+			};
+
+			auto final_suspend() noexcept {
+				return task_final_suspend{};
+			}
+
+			void unhandled_exception() {
+				exception = std::current_exception();
+			}
+		};
+
+		template<typename T>
+		struct task_promise : task_promise_base {
+			std::variant<std::monostate, T> value;
+
+			task<T> get_return_object();
+
+			template<typename U>
+			void return_value(U&& v) {
+				value.template emplace<1>(std::forward<U>(v));
+			}
+
+			T result() {
+				if (exception)
+					std::rethrow_exception(exception);
+				return std::move(std::get<1>(value));
+			}
+		};
+
+		template<>
+		struct task_promise<void> : task_promise_base {
+			task<void> get_return_object();
+
+			void return_void() {}
+
+			void result() {
+				if (exception)
+					std::rethrow_exception(exception);
+			}
+		};
+	}
+
+	template<typename T>
+	struct task {
+		using promise_type = details::task_promise<T>;
+		using handle_type = std::coroutine_handle<promise_type>;
+
+		task(handle_type handle = nullptr) : handle{ handle } {}
+		task(task&& other) : handle{ other.handle } { other.handle = nullptr; }
+		task(const task& other) = delete;
+		task& operator=(const task& other) = delete;
+		task& operator=(task&& other) {
+			if (this != &other) {
+				if (handle)
+					handle.destroy();
+				handle = other.handle;
+				other.handle = nullptr;
+			}
+			return *this;
+		}
+
+		~task() {
+			if (handle)
+				handle.destroy();
+		}
+
+		struct task_awaiter {
+			handle_type child;
+
+			bool await_ready() const noexcept {
+				return child == nullptr || child.done();
+			}
+
+			template<typename Promise>
+			void await_suspend(std::coroutine_handle<Promise> parent) noexcept {
+				auto& promise = child.promise();
+				promise.continuation = parent;
+				promise.root = root_of(parent);
+				promise.root.promise().leaf = child;
+				promise.root.promise().transfer = true;
+			}
+
+			T await_resume() {
+				return child.promise().result();
+			}
+		};
+
+		task_awaiter operator co_await() const& noexcept {
+			return task_awaiter{ handle };
+		}
+
+		auto& get() const noexcept { return handle; }
+
+	private:
+		handle_type handle;
+	};
+
+	namespace details {
+		template<typename T>
+		inline task<T> task_promise<T>::get_return_object() {
+			return task<T>{ std::coroutine_handle<task_promise<T>>::from_promise(*this) };
+		}
+
+		inline task<void> task_promise<void>::get_return_object() {
+			return task<void>{ std::coroutine_handle<task_promise<void>>::from_promise(*this) };
+		}
+	}
+}
+
+#endif
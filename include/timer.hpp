@@ -0,0 +1,314 @@
+#ifndef _CORO_TIMER_H_
+#define _CORO_TIMER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include "scheduler.hpp"
+
+namespace coro {
+
+	namespace details {
+		using timer_clock = std::chrono::steady_clock;
+		// resolution of every timer
+		using timer_tick = std::chrono::milliseconds;
+
+		// current time in ticks of timer_clock
+		inline uint64_t now_tick() {
+			return (uint64_t)std::chrono::duration_cast<timer_tick>(timer_clock::now().time_since_epoch()).count();
+		}
+
+		// first tick at or after tp, so a timer never fires early
+		inline uint64_t tick_of(timer_clock::time_point tp) {
+			auto since_epoch = tp.time_since_epoch();
+			auto ticks = std::chrono::duration_cast<timer_tick>(since_epoch);
+			if (ticks < since_epoch)
+				ticks += timer_tick(1);
+			return ticks.count() < 0 ? 0 : (uint64_t)ticks.count();
+		}
+
+		struct timer_wheel;
+
+		// Intrusive timer, embedded in whatever waits for it.
+		struct timer_node {
+			timer_node* next = nullptr;
+			timer_node* prev = nullptr;
+			uint64_t deadline = 0;
+			// called by the wheel's driver once the deadline passed, with the wheel locked
+			void (*routine)(timer_node* self) = nullptr;
+			// the wheel the node is linked into, null once it fired or was cancelled.
+			// only changes with that wheel locked
+			std::atomic<timer_wheel*> wheel = nullptr;
+			uint32_t level = 0;
+		};
+
+		/*
+		Hierarchical timing wheel: `levels` wheels of `slots` lists each, level n
+		holding the timers that are due within slots^(n+1) ticks. Timers move one
+		level down whenever the level below wraps around, so insert and cancel are
+		O(1) and every timer is touched at most `levels` times before it fires.
+		The wheel is driven by one thread (a reactor) through timeout() and expire(),
+		everything else may add and cancel timers from any thread.
+		*/
+		struct timer_wheel {
+			static constexpr unsigned bits = 8;
+			static constexpr uint64_t slots = 1 << bits;
+			static constexpr uint64_t mask = slots - 1;
+			static constexpr unsigned levels = 4;
+			// farther timers sit in the last level and are placed again when they get there
+			static constexpr uint64_t span = (uint64_t)1 << (bits * levels);
+
+			std::mutex mtx;
+			uint64_t current;
+			size_t count[levels] = {};
+			// list heads, only next and prev are used
+			timer_node heads[levels][slots];
+			// the tick the driver sleeps until, 0 while it is awake
+			uint64_t wake_at = 0;
+
+			timer_wheel() : current(now_tick()) {
+				for (auto& level : heads) {
+					for (auto& head : level) {
+						head.next = head.prev = &head;
+					}
+				}
+			}
+
+			timer_wheel(const timer_wheel&) = delete;
+			timer_wheel& operator=(const timer_wheel&) = delete;
+
+			// Returns true if the driver sleeps past the deadline and has to be woken up.
+			bool add(timer_node* node) {
+				std::lock_guard<std::mutex> lg(mtx);
+				node->wheel.store(this, std::memory_order_release);
+				link(node);
+				return node->deadline < wake_at;
+			}
+
+			// Returns false if the timer already fired. Once this returns, the routine
+			// of node is not running and will not run.
+			bool cancel(timer_node* node) {
+				std::lock_guard<std::mutex> lg(mtx);
+				if (node->wheel.load(std::memory_order_relaxed) != this)
+					return false;
+				unlink(node);
+				return true;
+			}
+
+			// Moves a pending timer to a new deadline, does nothing if it already fired or
+			// was cancelled. Returns true if the driver has to be woken up.
+			bool reschedule(timer_node* node, uint64_t deadline) {
+				std::lock_guard<std::mutex> lg(mtx);
+				if (node->wheel.load(std::memory_order_relaxed) != this)
+					return false;
+				unlink(node);
+				node->deadline = deadline;
+				node->wheel.store(this, std::memory_order_relaxed);
+				link(node);
+				return deadline < wake_at;
+			}
+
+			// Milliseconds the driver may sleep, -1 for as long as it likes.
+			// The driver is then considered asleep until expire().
+			int timeout() {
+				std::lock_guard<std::mutex> lg(mtx);
+				uint64_t next = next_expiry();
+				if (next == UINT64_MAX) {
+					wake_at = UINT64_MAX;
+					return -1;
+				}
+				uint64_t now = now_tick();
+				wake_at = next;
+				return next <= now ? 0 : (int)std::min<uint64_t>(next - now, INT32_MAX);
+			}
+
+			// Fires every timer whose deadline has passed.
+			void expire() {
+				std::lock_guard<std::mutex> lg(mtx);
+				wake_at = 0;
+				uint64_t target = now_tick();
+				while (current < target) {
+					if (count[0] == 0) {
+						if (empty()) {
+							current = target;
+							break;
+						}
+						// nothing can fire before level 0 wraps around, skip to there
+						uint64_t wrap = (current | mask) + 1;
+						if (wrap > target) {
+							current = target;
+							break;
+						}
+						current = wrap - 1;
+					}
+					current++;
+					if ((current & mask) == 0)
+						cascade(1);
+					fire(heads[0][current & mask]);
+				}
+			}
+
+		private:
+			void link(timer_node* node) {
+				// anything already due goes off with the next tick
+				uint64_t deadline = std::max(node->deadline, current + 1);
+				uint64_t delta = std::min(deadline - current, span - 1);
+				unsigned level = 0;
+				while (delta >= ((uint64_t)1 << (bits * (level + 1))))
+					level++;
+				if (deadline - current >= span)
+					deadline = current + span - 1;
+
+				timer_node& head = heads[level][(deadline >> (bits * level)) & mask];
+				node->next = &head;
+				node->prev = head.prev;
+				node->level = level;
+				head.prev->next = node;
+				head.prev = node;
+				count[level]++;
+			}
+
+			void unlink(timer_node* node) {
+				node->prev->next = node->next;
+				node->next->prev = node->prev;
+				node->next = node->prev = nullptr;
+				node->wheel.store(nullptr, std::memory_order_relaxed);
+				count[node->level]--;
+			}
+
+			bool empty() const {
+				for (auto c : count) {
+					if (c != 0)
+						return false;
+				}
+				return true;
+			}
+
+			void cascade(unsigned level) {
+				if (level >= levels)
+					return;
+				uint64_t index = (current >> (bits * level)) & mask;
+				if (index == 0)
+					cascade(level + 1);
+
+				timer_node& head = heads[level][index];
+				timer_node* n = head.next;
+				head.next = head.prev = &head;
+				while (n != &head) {
+					timer_node* next = n->next;
+					count[level]--;
+					link(n);
+					n = next;
+				}
+			}
+
+			void fire(timer_node& head) {
+				while (head.next != &head) {
+					timer_node* n = head.next;
+					unlink(n);
+					n->routine(n);
+				}
+			}
+
+			// The tick of the first timer in level 0; for the upper levels, where the first
+			// non-empty slot begins, which no timer in it is due before.
+			uint64_t next_expiry() const {
+				uint64_t next = UINT64_MAX;
+				for (unsigned level = 0; level < levels; level++) {
+					if (count[level] == 0)
+						continue;
+					unsigned shift = bits * level;
+					// a level holds the next slots blocks of its size, also past the point where it wraps around
+					uint64_t block = current >> shift;
+					for (uint64_t b = block + 1; b <= block + slots; b++) {
+						const timer_node& head = heads[level][b & mask];
+						if (head.next != &head) {
+							next = std::min(next, b << shift);
+							break;
+						}
+					}
+				}
+				return next;
+			}
+		};
+
+		// Puts node into the wheel of the reactor that serves the calling thread.
+		void add_timer(timer_node* node);
+
+		inline bool cancel_timer(timer_node* node) {
+			// a node is added once, so a wheel read here is still the right lock to take
+			timer_wheel* wheel = node->wheel.load(std::memory_order_acquire);
+			return wheel != nullptr && wheel->cancel(node);
+		}
+	}
+
+	/*
+	Suspends the coroutine until the timer goes off. The coroutine is resumed on
+	the worker paired with the reactor that owns the timer, which is the one
+	paired with the worker that started the wait.
+	co_await returns false when the task got cancelled before that.
+	*/
+	struct sleep_awaiter : details::timer_node {
+		coroutine_handle handle = nullptr;
+		// false for sleep_for/sleep_until, which do not suspend when already due
+		bool always_suspend;
+		bool cancelled = false;
+		details::cancel_registration<sleep_awaiter> cancel;
+
+		sleep_awaiter(uint64_t deadline, bool always_suspend) : always_suspend(always_suspend) {
+			this->deadline = deadline;
+			routine = &sleep_awaiter::on_timer;
+		}
+
+		sleep_awaiter(const sleep_awaiter&) = delete;
+		sleep_awaiter& operator=(const sleep_awaiter&) = delete;
+
+		static void on_timer(details::timer_node* self) {
+			go(static_cast<sleep_awaiter*>(self)->handle);
+		}
+
+		bool await_ready() const {
+			return !always_suspend && deadline <= details::now_tick();
+		}
+
+		void await_suspend(root_handle h) {
+			handle = h;
+			park(h, "sleep");
+			details::add_timer(this);
+			cancel.watch(h.promise().cancel_token, this);
+		}
+
+		void on_cancel() {
+			// the timer cannot fire any more once it is taken out
+			if (details::cancel_timer(this)) {
+				cancelled = true;
+				go(handle);
+			}
+		}
+
+		bool await_resume() const {
+			return !cancelled;
+		}
+	};
+
+	inline sleep_awaiter sleep_until(std::chrono::steady_clock::time_point tp) {
+		return { details::tick_of(tp), false };
+	}
+
+	template<typename _Rep, typename _Period>
+	sleep_awaiter sleep_for(std::chrono::duration<_Rep, _Period> d) {
+		return sleep_until(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(d));
+	}
+
+	// Like sleep_for, but always gives the worker up, even for a zero or negative
+	// duration; the coroutine then runs again on the reactor's next turn.
+	template<typename _Rep, typename _Period>
+	sleep_awaiter yield_for(std::chrono::duration<_Rep, _Period> d) {
+		auto tp = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(d);
+		return { details::tick_of(tp), true };
+	}
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _CORO_TRACING_H_
+#define _CORO_TRACING_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace coro::tracing {
+
+	/*
+	Timeline of the tasks, for finding out where a slow request spent its time.
+	Between start() and stop() every thread appends timestamped events to a
+	buffer of its own: a task spawned by another one, made ready by go(), resumed
+	and suspended by a worker, parked in an awaiter (with what it waits for,
+	see park()). A thread whose buffer is full drops the rest.
+
+	write_chrome_trace() turns them into the Chrome trace event format, which
+	chrome://tracing and ui.perfetto.dev open. Every run of a task is a slice on
+	the thread that ran it, the time in between an async slice on a track of
+	the task ("queued", or what it was parked in), and an arrow goes from
+	where a task was spawned to its first run, so a whole tree of tasks can be
+	followed.
+
+	Define CORO_TRACING (cmake -DLIBCORO_TRACING=ON) for the whole build to get
+	any of this; without it there is nothing to call and nothing is recorded.
+	*/
+
+	// events one thread keeps
+	constexpr size_t buffer_capacity = 1 << 16;
+
+#ifdef CORO_TRACING
+	// Starts recording, events from before are left out of the export and every
+	// thread gets its whole buffer back.
+	void start();
+
+	void stop();
+
+	// false if path could not be written
+	bool write_chrome_trace(const char* path);
+
+	// events lost to a full buffer since start()
+	uint64_t dropped();
+#endif
+}
+
+#endif
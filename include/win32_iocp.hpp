@@ -114,7 +114,7 @@ namespace coro::net
 			return false;
 		}
 		
-		bool await_suspend(coroutine_handle handle) {
+		bool await_suspend(root_handle handle) {
 			win32::init_overlapped(&overlapped, [this, handle](DWORD err, size_t) {
 				ok = err == 0;
 				go(handle);
@@ -123,7 +123,7 @@ namespace coro::net
 			if(ret == FALSE && WSAGetLastError() != WSA_IO_PENDING) {
 				return false;
 			}
-			park(handle);
+			park(handle, "accept");
 			return true;
 		}
 
@@ -163,7 +163,7 @@ namespace coro::net
 			return false;
 		}
 		
-		bool await_suspend(coroutine_handle handle) {
+		bool await_suspend(root_handle handle) {
 			win32::init_overlapped(&overlapped, [this, handle](DWORD errorCode, size_t trans) {
 				WSASetLastError(errorCode);
 				if (errorCode == 0)
@@ -181,7 +181,7 @@ namespace coro::net
 			but the IOCP object will still receive a notification,
 			so we suspend the coroutine in order to ensure that the overlapped is valid.
 			*/
-			park(handle);
+			park(handle, "recv");
 			return true;
 		}
 
@@ -211,7 +211,7 @@ namespace coro::net
 			return false;
 		}
 		
-		bool await_suspend(coroutine_handle handle) {
+		bool await_suspend(root_handle handle) {
 			win32::init_overlapped(&overlapped, [this, handle](DWORD errorCode, size_t trans) {
 				WSASetLastError(errorCode);
 				if (errorCode == 0)
@@ -228,7 +228,7 @@ namespace coro::net
 			if (ret == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
 				return false;
 			}
-			park(handle);
+			park(handle, "send");
 			return true;
 		}
 
@@ -253,7 +253,7 @@ namespace coro::net
 			return true;
 		}
 
-		void await_suspend(coroutine_handle h) {
+		void await_suspend(root_handle h) {
 		}
 
 		int await_resume() const {
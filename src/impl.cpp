@@ -1,8 +1,29 @@
 #include <scheduler.hpp>
+#include <log.hpp>
+#include <tracing.hpp>
 
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <cctype>
+#include <map>
+#endif
 #ifdef min
 #define min_undefined
 #undef min
@@ -16,6 +37,127 @@
 namespace coro {
 
 	namespace details {
+		// Tells the core we are in a spin loop, where there is an instruction for that.
+		inline void cpu_relax() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+			_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			asm volatile("yield");
+#endif
+		}
+
+#ifdef __linux__
+		// CPUs the process may run on, in ascending order.
+		std::vector<int> allowed_cpus() {
+			std::vector<int> cpus;
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+				for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+					if (CPU_ISSET(cpu, &set))
+						cpus.push_back(cpu);
+				}
+			}
+			return cpus;
+		}
+
+		// NUMA node of a CPU, 0 when sysfs does not tell.
+		int numa_node_of(int cpu) {
+			std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+			DIR* dir = opendir(path.c_str());
+			if (dir == nullptr)
+				return 0;
+			int node = 0;
+			while (dirent* entry = readdir(dir)) {
+				// a nodeN link per CPU
+				if (strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char)entry->d_name[4])) {
+					node = atoi(entry->d_name + 4);
+					break;
+				}
+			}
+			closedir(dir);
+			return node;
+		}
+
+		void pin_thread(const std::vector<int>& cpus) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for (int cpu : cpus) {
+				if (cpu >= 0 && cpu < CPU_SETSIZE)
+					CPU_SET(cpu, &set);
+			}
+			pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		}
+
+		// CPUs of each of count workers, empty when they are not pinned.
+		std::vector<std::vector<int>> worker_cpu_sets(const executor_options& options, size_t count) {
+			if (!options.cpu_sets.empty())
+				return options.cpu_sets;
+			if (options.affinity == worker_affinity::none)
+				return {};
+			std::vector<int> cpus = allowed_cpus();
+			if (cpus.empty())
+				return {};
+			std::map<int, std::vector<int>> nodes;
+			if (options.affinity == worker_affinity::numa_node) {
+				for (int cpu : cpus) {
+					nodes[numa_node_of(cpu)].push_back(cpu);
+				}
+			}
+			std::vector<std::vector<int>> sets(count);
+			for (size_t i = 0; i < count; i++) {
+				int cpu = cpus[i % cpus.size()];
+				if (options.affinity == worker_affinity::core)
+					sets[i] = { cpu };
+				else
+					sets[i] = nodes[numa_node_of(cpu)];
+			}
+			return sets;
+		}
+#endif
+
+		// Bounded single-producer/multi-consumer ring used as a worker's local run queue.
+		// Only the owning worker pushes at the tail; the owner and thieves pop from the head.
+		template<size_t Capacity>
+		struct local_run_queue {
+			static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+			std::atomic<uint64_t> head = 0;
+			std::atomic<uint64_t> tail = 0;
+			std::atomic<void*> buffer[Capacity] = {};
+
+			bool push(coroutine_handle handle) {
+				uint64_t t = tail.load(std::memory_order_relaxed);
+				uint64_t h = head.load(std::memory_order_acquire);
+				if (t - h >= Capacity)
+					return false;
+				buffer[t & (Capacity - 1)].store(handle.address(), std::memory_order_relaxed);
+				tail.store(t + 1, std::memory_order_release);
+				return true;
+			}
+
+			coroutine_handle pop() {
+				uint64_t h = head.load(std::memory_order_acquire);
+				while (true) {
+					uint64_t t = tail.load(std::memory_order_acquire);
+					if (h == t)
+						return nullptr;
+					void* value = buffer[h & (Capacity - 1)].load(std::memory_order_relaxed);
+					// the slot can only be reused by the producer once head moved past it
+					if (head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+						return coroutine_handle::from_address(value);
+				}
+			}
+
+			size_t size() const {
+				uint64_t t = tail.load(std::memory_order_acquire);
+				uint64_t h = head.load(std::memory_order_acquire);
+				return t > h ? (size_t)(t - h) : 0;
+			}
+		};
+
 		template<typename arg_pool>
 		struct thread_worker {
 		private:
@@ -77,6 +219,535 @@ namespace coro {
 		};
 	}
 
+	namespace details {
+#ifdef CORO_FRAME_POOL_STATS
+		struct frame_cache_registry {
+			std::mutex mtx;
+			frame_cache* head = nullptr;
+			// counters of the threads that already exited
+			frame_pool_stats retired;
+		};
+
+		frame_cache_registry& get_frame_cache_registry() {
+			static frame_cache_registry* registry = new frame_cache_registry();
+			return *registry;
+		}
+
+		frame_cache::frame_cache() {
+			auto& registry = get_frame_cache_registry();
+			std::lock_guard<std::mutex> lg(registry.mtx);
+			next_cache = registry.head;
+			if (registry.head != nullptr)
+				registry.head->prev_cache = this;
+			registry.head = this;
+		}
+#endif
+
+		frame_cache::~frame_cache() {
+			for (size_t c = 0; c < class_count; c++) {
+				while (lists[c] != nullptr) {
+					free_block* block = lists[c];
+					lists[c] = block->next;
+					::operator delete(block);
+				}
+				counts[c] = 0;
+			}
+			destroyed = true;
+
+#ifdef CORO_FRAME_POOL_STATS
+			auto& registry = get_frame_cache_registry();
+			std::lock_guard<std::mutex> lg(registry.mtx);
+			registry.retired.allocations += stats.allocations.load(std::memory_order_relaxed);
+			registry.retired.hits += stats.hits.load(std::memory_order_relaxed);
+			registry.retired.deallocations += stats.deallocations.load(std::memory_order_relaxed);
+			registry.retired.recycled += stats.recycled.load(std::memory_order_relaxed);
+			if (prev_cache != nullptr)
+				prev_cache->next_cache = next_cache;
+			else
+				registry.head = next_cache;
+			if (next_cache != nullptr)
+				next_cache->prev_cache = prev_cache;
+#endif
+		}
+	}
+
+#ifdef CORO_METRICS
+	namespace metrics::details {
+		struct block_registry {
+			std::mutex mtx;
+			thread_block* head = nullptr;
+			// counters of the threads that already exited
+			counters retired;
+		};
+
+		block_registry& get_block_registry() {
+			static block_registry* registry = new block_registry();
+			return *registry;
+		}
+
+		thread_block::thread_block() {
+			auto& registry = get_block_registry();
+			std::lock_guard<std::mutex> lg(registry.mtx);
+			next_block = registry.head;
+			if (registry.head != nullptr)
+				registry.head->prev_block = this;
+			registry.head = this;
+		}
+
+		thread_block::~thread_block() {
+			auto& registry = get_block_registry();
+			std::lock_guard<std::mutex> lg(registry.mtx);
+			registry.retired.merge(read());
+			if (prev_block != nullptr)
+				prev_block->next_block = next_block;
+			else
+				registry.head = next_block;
+			if (next_block != nullptr)
+				next_block->prev_block = prev_block;
+		}
+	}
+#endif
+
+	namespace log::details {
+		struct ring_registry {
+			std::mutex mtx;
+			std::condition_variable cv;
+			ring* head = nullptr;
+			size_t threads = 0;
+			bool woken = false;
+			bool stopping = false;
+			sink output = nullptr;
+			uint64_t start_ns = 0;
+			std::thread writer;
+		};
+
+		ring_registry& get_ring_registry() {
+			static ring_registry* registry = new ring_registry();
+			return *registry;
+		}
+
+		// One conversion of record r, spec holds the flags, width and precision, with the length modifiers dropped.
+		void format_arg(char*& out, char* end, std::string spec, char conversion, const record& r, const value& v) {
+			if (out >= end)
+				return;
+			size_t room = end - out;
+			int n = 0;
+			switch (conversion) {
+			case 'd': case 'i':
+				n = snprintf(out, room, (spec + "ll" + conversion).c_str(), (long long)v.i);
+				break;
+			case 'u': case 'o': case 'x': case 'X':
+				n = snprintf(out, room, (spec + "ll" + conversion).c_str(), (unsigned long long)v.i);
+				break;
+			case 'c':
+				n = snprintf(out, room, (spec + conversion).c_str(), (int)v.i);
+				break;
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+				n = snprintf(out, room, (spec + conversion).c_str(), v.d);
+				break;
+			case 's':
+				n = snprintf(out, room, (spec + conversion).c_str(), v.i < text_size ? r.text + v.i : "");
+				break;
+			default:
+				n = snprintf(out, room, (spec + 'p').c_str(), v.p);
+				break;
+			}
+			out += n > 0 ? std::min<size_t>(n, room - 1) : 0;
+		}
+
+		void format_record(const record& r, size_t thread_index, uint64_t start_ns, char* buffer, size_t size) {
+			char* out = buffer;
+			char* end = buffer + size;
+			int n = snprintf(out, size, "%12.6f T%zu %-5s ", (double)(r.time_ns - start_ns) / 1e9, thread_index, name_of(r.lvl));
+			out += n > 0 ? std::min<size_t>(n, size - 1) : 0;
+			size_t arg = 0;
+			for (const char* f = r.format; *f != 0 && out + 1 < end; f++) {
+				if (*f != '%') {
+					*out++ = *f;
+					continue;
+				}
+				if (f[1] == '%') {
+					*out++ = '%';
+					f++;
+					continue;
+				}
+				std::string spec = "%";
+				f++;
+				while (*f != 0 && strchr("-+ #0123456789.", *f) != nullptr)
+					spec += *f++;
+				while (*f != 0 && strchr("hlLqjzt", *f) != nullptr)
+					f++;
+				if (*f == 0)
+					break;
+				if (arg < r.arg_count)
+					format_arg(out, end - 1, spec, *f, r, r.args[arg++]);
+			}
+			*out = 0;
+		}
+
+		// must be called with the registry lock held
+		void drain_locked(ring_registry& registry) {
+			char line[512];
+			ring** link = &registry.head;
+			while (ring* q = *link) {
+				bool retired = q->retired.load(std::memory_order_acquire);
+				uint64_t h = q->head.load(std::memory_order_relaxed);
+				uint64_t t = q->tail.load(std::memory_order_acquire);
+				for (; h != t; h++) {
+					auto& r = q->records[h % ring::capacity];
+					format_record(r, q->thread_index, registry.start_ns, line, sizeof(line));
+					if (registry.output != nullptr)
+						registry.output(r.lvl, line);
+					else
+						fprintf(stderr, "%s\n", line);
+					q->head.store(h + 1, std::memory_order_release);
+				}
+				// its thread is gone, so nothing was queued after the retired flag
+				if (retired) {
+					*link = q->next;
+					delete q;
+					continue;
+				}
+				link = &q->next;
+			}
+		}
+
+		void writer_main() {
+			auto& registry = get_ring_registry();
+			std::unique_lock<std::mutex> ul(registry.mtx);
+			while (true) {
+				registry.cv.wait(ul, [&registry]() { return registry.woken || registry.stopping; });
+				registry.woken = false;
+				drain_locked(registry);
+				if (registry.stopping)
+					return;
+			}
+		}
+
+		// at exit, whatever is still queued goes out before the process does
+		void stop_writer() {
+			auto& registry = get_ring_registry();
+			{
+				std::lock_guard<std::mutex> lg(registry.mtx);
+				registry.stopping = true;
+			}
+			registry.cv.notify_one();
+			// a sink may call exit() itself
+			if (registry.writer.joinable() && registry.writer.get_id() != std::this_thread::get_id())
+				registry.writer.join();
+			log::flush();
+		}
+
+		ring* acquire_ring() {
+			auto& registry = get_ring_registry();
+			ring* q = new ring();
+			std::lock_guard<std::mutex> lg(registry.mtx);
+			if (registry.threads == 0) {
+				registry.start_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+				registry.writer = std::thread(writer_main);
+				atexit(stop_writer);
+			}
+			q->thread_index = registry.threads++;
+			q->next = registry.head;
+			registry.head = q;
+			return q;
+		}
+
+		void notify() {
+			auto& registry = get_ring_registry();
+			{
+				std::lock_guard<std::mutex> lg(registry.mtx);
+				registry.woken = true;
+			}
+			registry.cv.notify_one();
+		}
+	}
+
+	void log::set_level(level l) {
+		details::runtime_level.store(l, std::memory_order_relaxed);
+	}
+
+	void log::set_sink(sink s) {
+		auto& registry = details::get_ring_registry();
+		std::lock_guard<std::mutex> lg(registry.mtx);
+		registry.output = s;
+	}
+
+	void log::flush() {
+		auto& registry = details::get_ring_registry();
+		std::lock_guard<std::mutex> lg(registry.mtx);
+		details::drain_locked(registry);
+		fflush(stderr);
+	}
+
+	uint64_t log::dropped() {
+		return details::dropped_count.load(std::memory_order_relaxed);
+	}
+
+	const char* log::name_of(level l) {
+		switch (l) {
+		case level::trace: return "TRACE";
+		case level::debug: return "DEBUG";
+		case level::info: return "INFO";
+		case level::warn: return "WARN";
+		case level::error: return "ERROR";
+		default: return "OFF";
+		}
+	}
+
+#ifdef CORO_TRACING
+	namespace tracing::details {
+		enum class kind : uint8_t {
+			spawn,
+			ready,
+			resume,
+			suspend,
+			wait,
+		};
+
+		struct event {
+			uint64_t ts_ns;
+			uint64_t task;
+			// the parent of a spawn
+			uint64_t parent;
+			// what a wait is for, how a run ended
+			const char* label;
+			kind k;
+		};
+
+		// Appended to by its thread only, size is published once the event is written.
+		struct thread_buffer {
+			std::unique_ptr<event[]> events{ new event[buffer_capacity] };
+			std::atomic<size_t> size = 0;
+			// the start() the events are from, the thread rewinds the buffer on a new one
+			uint64_t session = 0;
+			std::string name;
+		};
+
+		struct buffer_registry {
+			std::mutex mtx;
+			// kept after their threads exited, for the export
+			std::vector<std::unique_ptr<thread_buffer>> buffers;
+			std::atomic<bool> recording = false;
+			std::atomic<uint64_t> session = 0;
+			std::atomic<uint64_t> start_ns = 0;
+			std::atomic<uint64_t> next_id = 0;
+			std::atomic<uint64_t> dropped = 0;
+		};
+
+		buffer_registry& get_buffer_registry() {
+			static buffer_registry* registry = new buffer_registry();
+			return *registry;
+		}
+
+		static thread_local thread_buffer* tls_buffer = nullptr;
+		// set by the workers, the other threads are numbered
+		static thread_local std::string tls_name;
+
+		uint64_t now_ns() {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		uint64_t new_id() {
+			return get_buffer_registry().next_id.fetch_add(1, std::memory_order_relaxed) + 1;
+		}
+
+		void name_thread(std::string name) {
+			tls_name = std::move(name);
+		}
+
+		// ts 0 is now
+		void record(kind k, uint64_t task, uint64_t parent = 0, const char* label = nullptr, uint64_t ts = 0) {
+			auto& registry = get_buffer_registry();
+			if (!registry.recording.load(std::memory_order_acquire))
+				return;
+			thread_buffer* b = tls_buffer;
+			if (b == nullptr) {
+				std::lock_guard<std::mutex> lg(registry.mtx);
+				b = registry.buffers.emplace_back(std::make_unique<thread_buffer>()).get();
+				b->name = !tls_name.empty() ? tls_name : "thread " + std::to_string(registry.buffers.size() - 1);
+				tls_buffer = b;
+			}
+			uint64_t session = registry.session.load(std::memory_order_relaxed);
+			if (b->session != session) {
+				b->session = session;
+				b->size.store(0, std::memory_order_relaxed);
+			}
+			size_t n = b->size.load(std::memory_order_relaxed);
+			if (n == buffer_capacity) {
+				registry.dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			b->events[n] = { ts != 0 ? ts : now_ns(), task, parent, label, k };
+			b->size.store(n + 1, std::memory_order_release);
+		}
+
+		// what a task is doing between two of its events
+		struct task_state {
+			const char* waiting = nullptr;
+			bool queued = false;
+			bool running = false;
+			bool spawned = false;
+			bool resumed = false;
+			uint64_t parent = 0;
+			uint64_t run_start = 0;
+			size_t run_thread = 0;
+		};
+
+		struct writer {
+			FILE* out;
+			uint64_t start_ns;
+			bool first = true;
+
+			// s as the contents of a JSON string
+			void escaped(const std::string& s) {
+				for (unsigned char c : s) {
+					if (c == '"' || c == '\\')
+						fprintf(out, "\\%c", c);
+					else if (c < 0x20)
+						fprintf(out, "\\u%04x", c);
+					else
+						fputc(c, out);
+				}
+			}
+
+			void begin(const char* ph, const char* name, const char* cat, uint64_t ts, size_t tid) {
+				fprintf(out, "%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"cat\":\"%s\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f",
+					first ? "" : ",", ph, name, cat, tid, (double)(ts - start_ns) / 1000.0);
+				first = false;
+			}
+
+			// begin or end of an async slice on the track of task
+			void async(const char* ph, const char* name, uint64_t task, uint64_t ts, size_t tid) {
+				begin(ph, name, "task", ts, tid);
+				fprintf(out, ",\"id\":%llu}", (unsigned long long)task);
+			}
+		};
+	}
+
+	void tracing::start() {
+		auto& registry = details::get_buffer_registry();
+		registry.session.fetch_add(1);
+		registry.dropped.store(0);
+		registry.start_ns.store(details::now_ns());
+		registry.recording.store(true);
+	}
+
+	void tracing::stop() {
+		details::get_buffer_registry().recording.store(false);
+	}
+
+	uint64_t tracing::dropped() {
+		return details::get_buffer_registry().dropped.load(std::memory_order_relaxed);
+	}
+
+	bool tracing::write_chrome_trace(const char* path) {
+		using details::kind;
+		auto& registry = details::get_buffer_registry();
+		uint64_t start_ns = registry.start_ns.load();
+		std::vector<std::pair<details::event, size_t>> events;
+		std::vector<std::string> names;
+		{
+			std::lock_guard<std::mutex> lg(registry.mtx);
+			for (size_t i = 0; i < registry.buffers.size(); i++) {
+				auto& b = *registry.buffers[i];
+				names.push_back(b.name);
+				size_t n = b.size.load(std::memory_order_acquire);
+				for (size_t j = 0; j < n; j++) {
+					if (b.events[j].ts_ns >= start_ns)
+						events.emplace_back(b.events[j], i);
+				}
+			}
+		}
+		std::stable_sort(events.begin(), events.end(), [](auto& a, auto& b) { return a.first.ts_ns < b.first.ts_ns; });
+
+		FILE* out = fopen(path, "w");
+		if (out == nullptr)
+			return false;
+		details::writer w{ out, start_ns };
+		fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+		for (size_t i = 0; i < names.size(); i++) {
+			w.begin("M", "thread_name", "__metadata", start_ns, i);
+			fprintf(out, ",\"args\":{\"name\":\"");
+			w.escaped(names[i]);
+			fprintf(out, "\"}}");
+		}
+
+		std::unordered_map<uint64_t, details::task_state> tasks;
+		for (auto& [e, tid] : events) {
+			auto& t = tasks[e.task];
+			switch (e.k) {
+			case kind::spawn:
+				t.spawned = true;
+				t.parent = e.parent;
+				w.begin("s", "spawn", "spawn", e.ts_ns, tid);
+				fprintf(out, ",\"id\":%llu}", (unsigned long long)e.task);
+				break;
+			case kind::wait:
+				if (t.queued)
+					w.async("e", "queued", e.task, e.ts_ns, tid);
+				t.queued = false;
+				if (t.waiting != nullptr)
+					w.async("e", t.waiting, e.task, e.ts_ns, tid);
+				t.waiting = e.label;
+				w.async("b", t.waiting, e.task, e.ts_ns, tid);
+				break;
+			case kind::ready:
+				if (t.waiting != nullptr)
+					w.async("e", t.waiting, e.task, e.ts_ns, tid);
+				t.waiting = nullptr;
+				if (!t.queued)
+					w.async("b", "queued", e.task, e.ts_ns, tid);
+				t.queued = true;
+				break;
+			case kind::resume:
+				if (t.queued)
+					w.async("e", "queued", e.task, e.ts_ns, tid);
+				t.queued = false;
+				if (t.spawned && !t.resumed) {
+					w.begin("f", "spawn", "spawn", e.ts_ns, tid);
+					fprintf(out, ",\"id\":%llu,\"bp\":\"e\"}", (unsigned long long)e.task);
+				}
+				t.resumed = true;
+				t.running = true;
+				t.run_start = e.ts_ns;
+				t.run_thread = tid;
+				break;
+			case kind::suspend:
+				if (t.running) {
+					std::string name = "task " + std::to_string(e.task);
+					w.begin("X", name.c_str(), "run", t.run_start, t.run_thread);
+					fprintf(out, ",\"dur\":%.3f,\"args\":{\"task\":%llu,\"parent\":%llu,\"end\":\"%s\"}}",
+						(double)(e.ts_ns - t.run_start) / 1000.0, (unsigned long long)e.task, (unsigned long long)t.parent, e.label);
+				}
+				t.running = false;
+				if (e.label != nullptr && strcmp(e.label, "done") == 0)
+					tasks.erase(e.task);
+				break;
+			}
+		}
+		fprintf(out, "\n]}\n");
+		bool ok = ferror(out) == 0;
+		fclose(out);
+		return ok;
+	}
+#endif
+
+#ifdef CORO_FRAME_POOL_STATS
+	frame_pool_stats frame_pool_snapshot() {
+		auto& registry = details::get_frame_cache_registry();
+		std::lock_guard<std::mutex> lg(registry.mtx);
+		frame_pool_stats result = registry.retired;
+		for (auto c = registry.head; c != nullptr; c = c->next_cache) {
+			result.allocations += c->stats.allocations.load(std::memory_order_relaxed);
+			result.hits += c->stats.hits.load(std::memory_order_relaxed);
+			result.deallocations += c->stats.deallocations.load(std::memory_order_relaxed);
+			result.recycled += c->stats.recycled.load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+#endif
+
 	struct awaiter_pool {
 		std::vector<thread_awaiter*> awaiters;
 		size_t size() const { return awaiters.size(); }
@@ -99,157 +770,912 @@ namespace coro {
 		void schedule(thread_awaiter* awaiter) {
 			workers.push_arg(awaiter);
 		}
+
+		// every awaiter gets a thread of its own
+		void schedule(thread_awaiter** awaiters, size_t count) {
+			workers.push_arg(awaiters, count);
+		}
 	} *__thread_scheduler = new thread_scheduler();
 
+	struct coroutine_scheduler;
+
+	// Starts the clock of metrics::series::queue_ns, for the sampled wakeups.
+	static void mark_ready([[maybe_unused]] coroutine_handle handle) {
+#ifdef CORO_METRICS
+		handle.promise().ready_since = metrics::details::sample_ready();
+#endif
+	}
+
+	struct executor {
+		std::string name;
+		coroutine_scheduler* scheduler = nullptr;
+	};
+
 	struct coroutine_scheduler {
 	private:
+		static constexpr size_t local_queue_capacity = 256;
+		// how many handles a worker moves from the global queue in one go
+		static constexpr size_t global_batch = 32;
+		// how often a worker looks at the global queue before its own one
+		static constexpr size_t global_check_interval = 61;
+		// how many times in a row the LIFO slot may bypass the local queue
+		static constexpr size_t max_lifo_polls = 16;
+		// an idle worker looks for work this many times, a few tens of microseconds, before it parks
+		static constexpr size_t default_spin_rounds = 32;
+		static constexpr size_t pauses_per_round = 16;
+
+		struct worker_state {
+			details::local_run_queue<local_queue_capacity> queue;
+			// task_priority::high, taken before anything else
+			details::local_run_queue<local_queue_capacity> urgent;
+			// the handle woken last by this worker, run before anything else
+			coroutine_handle next = nullptr;
+			size_t lifo_polls = 0;
+			size_t tick = 0;
+			uint64_t seed[2];
+			size_t index;
+			coroutine_scheduler* owner;
+			std::thread thread;
+			// empty if the worker is not pinned
+			std::vector<int> cpus;
+			// NUMA node of cpus, stolen from before the other domains
+			int domain = 0;
+
+			// handles queued to this worker by other threads, see set_home_worker().
+			// a vector keeps its capacity, so the steady state allocates nothing
+			std::mutex inbox_mtx;
+			std::vector<coroutine_handle> inbox;
+			std::atomic<size_t> inbox_size = 0;
+
+			// set under mtx when the worker parks, cleared by whoever unparks it.
+			// The worker waits on it with atomic::wait, a futex on Linux
+			std::atomic<bool> sleeping = false;
+			// counted in coroutine_scheduler::searching; set by the worker itself or, while it is parked, by unpark_locked
+			bool searching = false;
+		};
+
+		static inline thread_local worker_state* current_worker = nullptr;
+		static inline thread_local size_t home_worker = SIZE_MAX;
+	public:
+		// the task being resumed by this thread
+		static inline thread_local coroutine_handle current_task = nullptr;
+	private:
+
 		std::mutex mtx, mtx_main;
 
 		std::stop_source stop_;
-		std::vector<coroutine_handle> coroutines;
-		std::condition_variable cv_schedule, cv_main_done;
-		std::vector<std::thread> worker_threads;
+		// submissions from threads that are not workers of this scheduler
+		std::deque<coroutine_handle> coroutines;
+		std::deque<coroutine_handle> urgent_coroutines;
+		// size of urgent_coroutines, read without mtx
+		std::atomic<size_t> urgent_count = 0;
+		executor* const owner_executor;
+		// threads == 0 starts one worker per hardware thread
+		const executor_options options;
+		const schedule_policy policy;
+		// more than one when pinned workers sit on several NUMA nodes
+		size_t domain_count = 1;
+		// set by start() when some worker is pinned
+		bool pinned = false;
+		std::condition_variable cv_main_done;
+		std::vector<std::unique_ptr<worker_state>> workers;
+		// parked workers, guarded by mtx; free_threads is their number, read without mtx
+		std::vector<worker_state*> sleepers;
 		std::atomic<size_t> free_threads = 0;
-		coroutine_handle main_handle;
+		// workers looking for work rather than running any. While there is one, new work wakes nobody,
+		// so a burst of go() unparks one worker at a time rather than all of them
+		std::atomic<size_t> searching = 0;
+		const size_t spin_rounds;
+		void* main_address = nullptr;
+		bool main_done = false;
 	public:
 
-		coroutine_scheduler(coroutine_handle main_handle) : main_handle(main_handle) {
+		coroutine_scheduler(executor* ex, executor_options options)
+			: owner_executor(ex), options(std::move(options)), policy(this->options.policy),
+			// spinning on a single core only keeps the thread that would bring the work off it
+			spin_rounds(std::thread::hardware_concurrency() > 1 ? default_spin_rounds : 0) {
+		}
+
+		// queues the coroutine wait_for_main() waits for, before start()
+		void submit_main(coroutine_handle main_handle) {
+			main_address = main_handle.address();
+			main_handle.promise().status.store(task_status::ready);
+			metrics::details::count(metrics::event::spawned);
+			mark_ready(main_handle);
+#ifdef CORO_TRACING
+			main_handle.promise().trace_id = tracing::details::new_id();
+			tracing::details::record(tracing::details::kind::spawn, main_handle.promise().trace_id);
+			tracing::details::record(tracing::details::kind::ready, main_handle.promise().trace_id);
+#endif
 			coroutines.push_back(main_handle);
-			buy(1);
+		}
+
+		void start() {
+			static size_t max_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+			size_t count = options.threads != 0 ? options.threads : max_count;
+#ifdef __linux__
+			auto cpu_sets = details::worker_cpu_sets(options, count);
+#endif
+			std::vector<int> domains;
+			for (size_t i = 0; i < count; i++) {
+				auto& w = workers.emplace_back(std::make_unique<worker_state>());
+				w->seed[0] = (uint64_t)rand() | 1;
+				w->seed[1] = (uint64_t)i + 1;
+				w->index = i;
+				w->owner = this;
+#ifdef __linux__
+				if (!cpu_sets.empty() && !cpu_sets[i % cpu_sets.size()].empty()) {
+					w->cpus = cpu_sets[i % cpu_sets.size()];
+					w->domain = details::numa_node_of(w->cpus[0]);
+					pinned = true;
+				}
+#endif
+				if (std::find(domains.begin(), domains.end(), w->domain) == domains.end())
+					domains.push_back(w->domain);
+			}
+			domain_count = domains.size();
+			for (auto& w : workers) {
+				w->thread = std::thread(&coroutine_scheduler::worker_thread_main, this, w.get(), stop_.get_token());
+			}
 		}
 
 		void schedule(coroutine_handle handle) {
-			std::lock_guard<std::mutex> lg(mtx);
-			buy(1);
-			coroutines.emplace_back(handle);
-			cv_schedule.notify_one();
+			worker_state* self = current_worker;
+			if (!is_local(self)) {
+				if (worker_state* home = home_of_thread(); home != nullptr) {
+					push_inbox(home, &handle, 1);
+					return;
+				}
+				std::lock_guard<std::mutex> lg(mtx);
+				push_global_locked(handle);
+				wake_searcher_locked();
+				return;
+			}
+
+			if (policy == schedule_policy::fifo || is_urgent(handle)) {
+				push_local(self, handle);
+				notify_idle();
+				return;
+			}
+
+			// the woken coroutine is likely to touch what the current one just did,
+			// so it runs next on this thread; the one it displaces becomes stealable
+			coroutine_handle displaced = self->next;
+			self->next = handle;
+			if (displaced != nullptr) {
+				push_local(self, displaced);
+				notify_idle();
+			}
 		}
 
 		void schedule(std::vector<coroutine_handle>& handles) {
-			std::lock_guard<std::mutex> lg(mtx);
-			buy(handles.size());
-			for (auto v : handles) {
-				coroutines.emplace_back(v);
+			schedule(handles.data(), handles.size());
+		}
+
+		void schedule(coroutine_handle* handles, size_t count) {
+			if (count == 0)
+				return;
+
+			worker_state* self = current_worker;
+			if (!is_local(self)) {
+				if (worker_state* home = home_of_thread(); home != nullptr) {
+					push_inbox(home, handles, count);
+					return;
+				}
+				std::lock_guard<std::mutex> lg(mtx);
+				for (size_t i = 0; i < count; i++) {
+					push_global_locked(handles[i]);
+				}
+				wake_searcher_locked();
+				return;
+			}
+
+			if (count == 1) {
+				schedule(handles[0]);
+				return;
+			}
+
+			// the ones that do not fit move to the front of handles
+			size_t spilled = 0;
+			for (size_t i = 0; i < count; i++) {
+				if (!queue_of(self, handles[i]).push(handles[i]))
+					handles[spilled++] = handles[i];
+			}
+			// see notify_idle
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (spilled > 0 || should_wake()) {
+				std::lock_guard<std::mutex> lg(mtx);
+				for (size_t i = 0; i < spilled; i++) {
+					push_global_locked(handles[i]);
+				}
+				// the one woken wakes the next once it found work, see worker_thread_main
+				wake_searcher_locked();
 			}
-			cv_schedule.notify_all();
 		}
 
 		void stop_schedule() {
-			stop_.request_stop();
-			cv_schedule.notify_all();
-			for (auto& v : worker_threads) {
-				v.join();
+			{
+				std::lock_guard<std::mutex> lg(mtx);
+				stop_.request_stop();
+				for (auto& w : workers) {
+					w->sleeping.store(false);
+					w->sleeping.notify_one();
+				}
+			}
+			for (auto& v : workers) {
+				v->thread.join();
 			}
-			worker_threads.clear();
+			workers.clear();
+			sleepers.clear();
 			free_threads = 0;
+			searching = 0;
 		}
 
 		void wait_for_main() {
 			std::unique_lock<std::mutex> ul(mtx_main);
-			cv_main_done.wait(ul, [this]() {return main_handle == nullptr; });
+			cv_main_done.wait(ul, [this]() {return main_done; });
 		}
+
+		size_t size() const {
+			return workers.size();
+		}
+
+		static void set_home_worker(size_t index) {
+			home_worker = index;
+		}
+
+		static size_t home_worker_of_thread() {
+			return home_worker;
+		}
+
+		// Moves the calling thread onto the CPUs of worker index, if it is pinned.
+		void pin_to_worker(size_t index) {
+#ifdef __linux__
+			if (!pinned || workers.empty())
+				return;
+			auto& cpus = workers[index % workers.size()]->cpus;
+			if (!cpus.empty())
+				details::pin_thread(cpus);
+#endif
+		}
+
+		size_t current_index() const {
+			worker_state* self = current_worker;
+			return is_local(self) ? self->index : SIZE_MAX;
+		}
+
+		static executor* current_executor() {
+			worker_state* self = current_worker;
+			return self != nullptr ? self->owner->owner_executor : nullptr;
+		}
+
+#ifdef CORO_METRICS
+		// tasks in the queues, summed up without stopping anybody
+		size_t ready_count() {
+			size_t count;
+			{
+				std::lock_guard<std::mutex> lg(mtx);
+				count = coroutines.size() + urgent_coroutines.size();
+			}
+			for (auto& w : workers) {
+				count += w->queue.size() + w->urgent.size() + w->inbox_size.load(std::memory_order_relaxed);
+			}
+			return count;
+		}
+#endif
 	private:
 
-		void buy(size_t count) {
-			static size_t max_count = (size_t)std::thread::hardware_concurrency();
-			size_t f = free_threads.load();
-			auto upto = std::min(max_count, worker_threads.size() + count - f);
+		worker_state* home_of_thread() {
+			if (home_worker == SIZE_MAX || workers.empty())
+				return nullptr;
+			return workers[home_worker % workers.size()].get();
+		}
+
+		void push_inbox(worker_state* w, coroutine_handle* handles, size_t count) {
+			if (count == 0)
+				return;
+			{
+				std::lock_guard<std::mutex> lg(w->inbox_mtx);
+				w->inbox.insert(w->inbox.end(), handles, handles + count);
+				w->inbox_size.store(w->inbox.size());
+			}
+			// pairs with the fence in wait_for_work like notify_idle does
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (w->sleeping.load(std::memory_order_relaxed) || should_wake()) {
+				std::lock_guard<std::mutex> lg(mtx);
+				if (w->sleeping.load())
+					unpark_locked(w);
+				else
+					// w may be stuck in a long task, an idle worker comes to take the inbox then
+					wake_searcher_locked();
+			}
+		}
 
-			for (size_t i = worker_threads.size(); i < upto; i++) {
-				worker_threads.emplace_back(&coroutine_scheduler::worker_thread_main, this, stop_.get_token());
+		// Moves the inbox of victim into the local queue of self and returns its first handle.
+		coroutine_handle take_inbox(worker_state* self, worker_state* victim) {
+			if (victim->inbox_size.load(std::memory_order_relaxed) == 0)
+				return nullptr;
+			std::lock_guard<std::mutex> lg(victim->inbox_mtx);
+			if (victim->inbox.empty())
+				return nullptr;
+			auto& inbox = victim->inbox;
+			auto handle = inbox.front();
+			size_t taken = 1;
+			while (taken < inbox.size() && queue_of(self, inbox[taken]).push(inbox[taken])) {
+				taken++;
 			}
+			inbox.erase(inbox.begin(), inbox.begin() + taken);
+			victim->inbox_size.store(inbox.size());
+			return handle;
+		}
+
+		// Unparks w as a searching worker, must be called with mtx held.
+		void unpark_locked(worker_state* w) {
+			sleepers.erase(std::find(sleepers.begin(), sleepers.end(), w));
+			free_threads--;
+			w->searching = true;
+			searching++;
+			w->sleeping.store(false, std::memory_order_release);
+			w->sleeping.notify_one();
 		}
 
-		size_t random() {
-			static uint64_t s[2] = { (uint64_t)rand(),  (uint64_t)rand() + 1 };
-			uint64_t a = s[0];
-			uint64_t b = s[1];
+		// Unparks the worker that parked last, unless one is searching already. Must be called with mtx held.
+		void wake_searcher_locked() {
+			if (searching.load() == 0 && !sleepers.empty())
+				unpark_locked(sleepers.back());
+		}
 
-			s[0] = b;
+		// after the fence of the caller, see notify_idle
+		bool should_wake() const {
+			return searching.load(std::memory_order_relaxed) == 0 && free_threads.load(std::memory_order_relaxed) > 0;
+		}
+
+		bool is_local(worker_state* w) const {
+			return w != nullptr && w->owner == this;
+		}
+
+		static bool is_urgent(coroutine_handle handle) {
+			return handle.promise().priority == task_priority::high;
+		}
+
+		static details::local_run_queue<local_queue_capacity>& queue_of(worker_state* w, coroutine_handle handle) {
+			return is_urgent(handle) ? w->urgent : w->queue;
+		}
+
+		// must be called with mtx held
+		void push_global_locked(coroutine_handle handle) {
+			if (is_urgent(handle)) {
+				urgent_coroutines.push_back(handle);
+				urgent_count.store(urgent_coroutines.size(), std::memory_order_relaxed);
+			}
+			else {
+				coroutines.push_back(handle);
+			}
+		}
+
+		void push_local(worker_state* self, coroutine_handle handle) {
+			if (!queue_of(self, handle).push(handle)) {
+				// the local queue is full, let the other workers pick it up from the global one
+				std::lock_guard<std::mutex> lg(mtx);
+				push_global_locked(handle);
+			}
+		}
+
+		void notify_idle() {
+			// pairs with the fence in wait_for_work: either the worker that stops searching
+			// or parks sees the new handle, or we see it stopped searching or parked
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (should_wake()) {
+				std::lock_guard<std::mutex> lg(mtx);
+				wake_searcher_locked();
+			}
+		}
+
+		size_t random(worker_state* self) {
+			uint64_t a = self->seed[0];
+			uint64_t b = self->seed[1];
+
+			self->seed[0] = b;
 			a ^= a << 23;
 			a ^= a >> 18;
 			a ^= b;
 			a ^= b >> 5;
-			s[1] = a;
+			self->seed[1] = a;
 
 			return a + b;
 		}
 
-		auto coro_select() {
-			size_t select_id = random() % coroutines.size();
-			auto handle = coroutines[select_id];
-			if (select_id != coroutines.size() - 1) {
-				coroutines[select_id] = coroutines.back();
+		coroutine_handle take_global(worker_state* self) {
+			std::lock_guard<std::mutex> lg(mtx);
+			if (coroutines.empty())
+				return nullptr;
+
+			auto handle = coroutines.front();
+			coroutines.pop_front();
+
+			size_t n = std::min(coroutines.size() / workers.size() + 1, global_batch);
+			for (size_t i = 0; i < n && !coroutines.empty(); i++) {
+				if (!self->queue.push(coroutines.front()))
+					break;
+				coroutines.pop_front();
 			}
-			coroutines.pop_back();
 			return handle;
 		}
 
-		void worker_thread_main(std::stop_token token) {
-			std::unique_lock<std::mutex> ul(mtx);
-			while (true) {
-				free_threads++;
-				cv_schedule.wait(ul, [this, token]() {return coroutines.size() > 0 || token.stop_requested(); });
-				free_threads--;
+		coroutine_handle take_urgent(worker_state* self) {
+			if (auto handle = self->urgent.pop(); handle != nullptr)
+				return handle;
+			if (urgent_count.load(std::memory_order_relaxed) == 0)
+				return nullptr;
+			std::lock_guard<std::mutex> lg(mtx);
+			if (urgent_coroutines.empty())
+				return nullptr;
+			auto handle = urgent_coroutines.front();
+			urgent_coroutines.pop_front();
+			urgent_count.store(urgent_coroutines.size(), std::memory_order_relaxed);
+			return handle;
+		}
 
-				if (token.stop_requested())
-					return;
+		coroutine_handle steal(worker_state* self) {
+			auto handle = steal(self, true);
+			// moving a task to another NUMA node is the last resort
+			if (handle == nullptr && domain_count > 1)
+				handle = steal(self, false);
+			if (handle != nullptr)
+				metrics::details::count(metrics::event::stolen);
+			return handle;
+		}
 
-				auto handle = coro_select();
-				if (handle.done()) {
-					handle.destroy();
+		coroutine_handle steal(worker_state* self, bool same_domain) {
+			size_t count = workers.size();
+			size_t start = random(self) % count;
+			for (size_t i = 0; i < count; i++) {
+				auto& victim = workers[(start + i) % count];
+				if (victim.get() == self || (victim->domain == self->domain) != same_domain)
 					continue;
+				if (auto handle = victim->urgent.pop(); handle != nullptr)
+					return handle;
+				if (auto handle = victim->queue.pop(); handle != nullptr)
+					return handle;
+				// its owner is busy, so I/O completions handed to it would wait
+				if (auto handle = take_inbox(self, victim.get()); handle != nullptr)
+					return handle;
+			}
+			return nullptr;
+		}
+
+		coroutine_handle find_work(worker_state* self) {
+			if (auto handle = take_urgent(self); handle != nullptr)
+				return handle;
+
+			if (self->next != nullptr) {
+				auto handle = self->next;
+				self->next = nullptr;
+				if (++self->lifo_polls <= max_lifo_polls)
+					return handle;
+				// two coroutines waking each other must not starve the local queue
+				push_local(self, handle);
+			}
+			self->lifo_polls = 0;
+
+			if (++self->tick % global_check_interval == 0) {
+				if (auto handle = take_global(self); handle != nullptr)
+					return handle;
+			}
+
+			if (auto handle = take_inbox(self, self); handle != nullptr)
+				return handle;
+
+			if (auto handle = self->queue.pop(); handle != nullptr)
+				return handle;
+
+			if (auto handle = take_global(self); handle != nullptr)
+				return handle;
+
+			return steal(self);
+		}
+
+		bool has_work() const {
+			if (!coroutines.empty() || !urgent_coroutines.empty())
+				return true;
+			for (auto& w : workers) {
+				if (w->queue.size() > 0 || w->urgent.size() > 0 || w->inbox_size.load() > 0)
+					return true;
+			}
+			return false;
+		}
+
+		// Looks for work a little longer before the worker parks. Only half of the workers
+		// search at once, the others park right away.
+		coroutine_handle spin_for_work(worker_state* self) {
+			if (!self->searching) {
+				if (2 * searching.load(std::memory_order_relaxed) >= workers.size())
+					return nullptr;
+				self->searching = true;
+				searching++;
+			}
+			for (size_t i = 0; i < spin_rounds; i++) {
+				for (size_t j = 0; j < pauses_per_round; j++) {
+					details::cpu_relax();
+				}
+				if (auto handle = find_work(self); handle != nullptr)
+					return handle;
+			}
+			return nullptr;
+		}
+
+		void wait_for_work(worker_state* self, std::stop_token& token) {
+			{
+				std::lock_guard<std::mutex> lg(mtx);
+				if (self->searching) {
+					self->searching = false;
+					searching--;
 				}
-				ul.unlock();
+				free_threads++;
+				self->sleeping.store(true);
+				sleepers.push_back(self);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (has_work() || token.stop_requested()) {
+					unpark_locked(self);
+					return;
+				}
+			}
+			metrics::details::count(metrics::event::worker_parked);
+			while (self->sleeping.load(std::memory_order_acquire)) {
+				self->sleeping.wait(true, std::memory_order_acquire);
+			}
+		}
 
-				handle.resume();
+		void run(worker_state* self, coroutine_handle handle) {
+			auto& status = handle.promise().status;
+			status.store(task_status::running);
 
-				ul.lock();
-				if (handle.done()) {
-					if (handle == main_handle) {
+			// awaited tasks return here instead of resuming each other from await_suspend,
+			// so a long chain of co_await never grows the stack whatever the optimization level
+			auto& promise = handle.promise();
+#ifdef CORO_METRICS
+			if (promise.ready_since != 0)
+				metrics::details::record(metrics::series::queue_ns, metrics::details::now_ns() - promise.ready_since);
+			metrics::details::count(metrics::event::resumed);
+#endif
+#ifdef CORO_TRACING
+			tracing::details::record(tracing::details::kind::resume, promise.trace_id);
+#endif
+			resume_guard* guard = promise.guard;
+			if (guard == nullptr || guard->routine(guard, handle)) [[likely]] {
+				current_task = handle;
+				do {
+					promise.transfer = false;
+					if (promise.leaf != nullptr)
+						promise.leaf.resume();
+					else
+						handle.resume();
+				} while (promise.transfer);
+				current_task = nullptr;
+			}
+
+			// nobody else can touch the handle until it leaves running/parking/notified,
+			// so this worker still owns it here
+			auto s = status.load();
+#ifdef CORO_TRACING
+			tracing::details::record(tracing::details::kind::suspend, promise.trace_id, 0,
+				s == task_status::done ? "done" : s == task_status::parking ? "parked" : "yield");
+#endif
+			while (true) {
+				if (s == task_status::done) {
+					if (handle.address() == main_address) {
 						std::scoped_lock<std::mutex> lg(mtx_main);
-						main_handle = nullptr;
+						main_done = true;
 						cv_main_done.notify_all();
 					}
+					metrics::details::count(metrics::event::destroyed);
 					handle.destroy();
+					return;
+				}
+
+				if (s == task_status::parking) {
+					if (status.compare_exchange_weak(s, task_status::suspend)) {
+						metrics::details::count(metrics::event::parked);
+						return;
+					}
+					continue;
+				}
+
+				// yielded, or woken up before it got off this thread
+				status.store(task_status::ready);
+				mark_ready(handle);
+#ifdef CORO_TRACING
+				tracing::details::record(tracing::details::kind::ready, promise.trace_id);
+#endif
+				if (executor* ex = handle.promise().exec; ex != nullptr && ex->scheduler != this) [[unlikely]] {
+					// switch_to() another executor
+					ex->scheduler->schedule(handle);
+					return;
 				}
-				else if (handle.promise().status == task_status::ready) {
-					coroutines.push_back(handle);
+				push_local(self, handle);
+				notify_idle();
+				return;
+			}
+		}
+
+		void worker_thread_main(worker_state* self, std::stop_token token) {
+			current_worker = self;
+			if (owner_executor == default_executor())
+				metrics::details::set_worker(self->index);
+#ifdef CORO_TRACING
+			tracing::details::name_thread(options.name + " worker " + std::to_string(self->index));
+#endif
+#ifdef __linux__
+			if (options.nice != 0)
+				setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), options.nice);
+			if (!self->cpus.empty())
+				details::pin_thread(self->cpus);
+#endif
+			while (!token.stop_requested()) {
+				auto handle = find_work(self);
+				if (handle == nullptr && spin_rounds > 0)
+					handle = spin_for_work(self);
+				if (handle == nullptr) {
+					wait_for_work(self, token);
+					continue;
+				}
+				if (self->searching) {
+					self->searching = false;
+					// the last searcher to find work wakes another one for whatever else there is
+					if (searching.fetch_sub(1) == 1)
+						notify_idle();
 				}
+				run(self, handle);
 			}
+			current_worker = nullptr;
 		}
 	} *__coroutine_scheduler;
 
+	struct executor_registry {
+		std::mutex mtx;
+		executor main{ "default" };
+		// never shrinks, so an executor* stays valid for good
+		std::vector<std::unique_ptr<executor>> executors;
+	};
+
+	executor_registry& get_executor_registry() {
+		static executor_registry* registry = new executor_registry();
+		return *registry;
+	}
+
+	static coroutine_scheduler* scheduler_of(coroutine_handle handle) {
+		executor* ex = handle.promise().exec;
+		return ex != nullptr ? ex->scheduler : __coroutine_scheduler;
+	}
+
+	// Schedules handles that are ready, in one call for those of the default executor.
+	static void schedule_all(coroutine_handle* handles, size_t count) {
+		size_t main_count = 0;
+		for (size_t i = 0; i < count; i++) {
+			coroutine_scheduler* scheduler = scheduler_of(handles[i]);
+			if (scheduler == __coroutine_scheduler)
+				handles[main_count++] = handles[i];
+			else
+				scheduler->schedule(handles[i]);
+		}
+		__coroutine_scheduler->schedule(handles, main_count);
+	}
 
 	inline bool awaiter_pool::invoke(thread_awaiter* awaiter) {
 		std::vector<coroutine_handle> handles;
 		awaiter->wait(handles);
-		__coroutine_scheduler->schedule(handles);
+		schedule_all(handles.data(), handles.size());
 		return !awaiter->should_suspend();
 	}
 
-	void start_main_coroutine(coroutine_handle main_handle) {
+	void start_main_coroutine(coroutine_handle main_handle, scheduler_options options) {
 		if (__coroutine_scheduler != nullptr) {
 			return;
 		}
 
-		__coroutine_scheduler = new coroutine_scheduler(main_handle);
+		auto& registry = get_executor_registry();
+		executor_options main_options;
+		main_options.name = registry.main.name;
+		main_options.threads = options.worker_count;
+		main_options.policy = options.policy;
+		main_options.affinity = options.affinity;
+		main_options.cpu_sets = std::move(options.cpu_sets);
+		__coroutine_scheduler = new coroutine_scheduler(&registry.main, std::move(main_options));
+		registry.main.scheduler = __coroutine_scheduler;
+		__coroutine_scheduler->submit_main(main_handle);
+		__coroutine_scheduler->start();
 		__coroutine_scheduler->wait_for_main();
 		__coroutine_scheduler->stop_schedule();
+
+		std::lock_guard<std::mutex> lg(registry.mtx);
+		for (auto& ex : registry.executors) {
+			ex->scheduler->stop_schedule();
+		}
+	}
+
+	executor* make_executor(executor_options options) {
+		auto& registry = get_executor_registry();
+		auto ex = std::make_unique<executor>();
+		ex->name = options.name;
+		options.threads = std::max<size_t>(1, options.threads);
+		ex->scheduler = new coroutine_scheduler(ex.get(), std::move(options));
+		ex->scheduler->start();
+		std::lock_guard<std::mutex> lg(registry.mtx);
+		return registry.executors.emplace_back(std::move(ex)).get();
+	}
+
+	executor* find_executor(std::string_view name) {
+		auto& registry = get_executor_registry();
+		if (name == registry.main.name)
+			return &registry.main;
+		std::lock_guard<std::mutex> lg(registry.mtx);
+		for (auto& ex : registry.executors) {
+			if (ex->name == name)
+				return ex.get();
+		}
+		return nullptr;
+	}
+
+	executor* default_executor() {
+		return &get_executor_registry().main;
+	}
+
+	executor* current_executor() {
+		return coroutine_scheduler::current_executor();
 	}
 
-	void park(coroutine_handle handle) {
+	void park(coroutine_handle handle, [[maybe_unused]] const char* reason) {
+#ifdef CORO_TRACING
+		// taken before a go() can see the task parked, so the wait sorts before its ready
+		uint64_t ts = tracing::details::now_ns();
+		uint64_t trace_id = handle.promise().trace_id;
+#endif
 		auto& status_ref = handle.promise().status;
-		if (status_ref == task_status::ready || status_ref == task_status::created)
-			status_ref = task_status::suspend;
+		auto s = status_ref.load();
+		while (true) {
+			task_status target;
+			if (s == task_status::running)
+				target = task_status::parking;
+			else if (s == task_status::ready || s == task_status::created)
+				target = task_status::suspend;
+			else
+				return;
+			if (status_ref.compare_exchange_weak(s, target)) {
+#ifdef CORO_TRACING
+				tracing::details::record(tracing::details::kind::wait, trace_id, 0, reason != nullptr ? reason : "parked", ts);
+#endif
+				return;
+			}
+		}
 	}
 
-	void go(coroutine_handle handle) {
+	void go(coroutine_handle handle, cancellation_token token) {
+		handle.promise().cancel_token = std::move(token);
+		go(handle);
+	}
+
+	void go(coroutine_handle handle, task_priority priority) {
+		handle.promise().priority = priority;
+		go(handle);
+	}
+
+	void go(coroutine_handle handle, executor* ex) {
+		handle.promise().exec = ex;
+		go(handle);
+	}
+
+	cancellation_token current_cancellation_token() {
+		coroutine_handle task = coroutine_scheduler::current_task;
+		return task != nullptr ? task.promise().cancel_token : cancellation_token{};
+	}
+
+	size_t worker_count() {
+		return __coroutine_scheduler != nullptr ? __coroutine_scheduler->size() : 0;
+	}
+
+	size_t current_worker_index() {
+		return __coroutine_scheduler != nullptr ? __coroutine_scheduler->current_index() : SIZE_MAX;
+	}
+
+	void set_home_worker(size_t index) {
+		// reactors call this on every turn
+		if (coroutine_scheduler::home_worker_of_thread() == index)
+			return;
+		coroutine_scheduler::set_home_worker(index);
+		if (__coroutine_scheduler != nullptr)
+			__coroutine_scheduler->pin_to_worker(index);
+	}
+
+#ifdef CORO_METRICS
+	metrics::stats metrics::snapshot() {
+		stats result;
+		{
+			auto& registry = details::get_block_registry();
+			std::lock_guard<std::mutex> lg(registry.mtx);
+			result.total = registry.retired;
+			for (auto b = registry.head; b != nullptr; b = b->next_block) {
+				counters c = b->read();
+				result.total.merge(c);
+				size_t index = b->worker.load(std::memory_order_relaxed);
+				if (index == SIZE_MAX)
+					continue;
+				if (result.workers.size() <= index)
+					result.workers.resize(index + 1);
+				result.workers[index].merge(c);
+			}
+		}
+		if (__coroutine_scheduler != nullptr)
+			result.ready = __coroutine_scheduler->ready_count();
+		result.alive = result.total[event::spawned] - result.total[event::destroyed];
+		return result;
+	}
+#endif
+
+	// Moves a created or suspended task to ready. Returns false if it is not for the caller to schedule.
+	static bool make_ready(coroutine_handle handle) {
 		auto& status_ref = handle.promise().status;
-		if (status_ref == task_status::created || status_ref == task_status::suspend) {
-			status_ref = task_status::ready;
-			__coroutine_scheduler->schedule(handle);
+		auto s = status_ref.load();
+		while (true) {
+			if (s == task_status::created || s == task_status::suspend) {
+				if (status_ref.compare_exchange_weak(s, task_status::ready)) {
+					auto& promise = handle.promise();
+					coroutine_handle parent = coroutine_scheduler::current_task;
+					mark_ready(handle);
+					if (s == task_status::created)
+						metrics::details::count(metrics::event::spawned);
+#ifdef CORO_TRACING
+					if (s == task_status::created) {
+						promise.trace_id = tracing::details::new_id();
+						tracing::details::record(tracing::details::kind::spawn, promise.trace_id, parent != nullptr ? parent.promise().trace_id : 0);
+					}
+					tracing::details::record(tracing::details::kind::ready, promise.trace_id);
+#endif
+					if (s == task_status::created && parent != nullptr) {
+						if (!promise.cancel_token.cancellable())
+							promise.cancel_token = parent.promise().cancel_token;
+						if (promise.exec == nullptr)
+							promise.exec = parent.promise().exec;
+					}
+					return true;
+				}
+			}
+			else if (s == task_status::running || s == task_status::parking) {
+				// still on its worker, which will queue it again once it is off the thread
+				if (status_ref.compare_exchange_weak(s, task_status::notified))
+					return false;
+			}
+			else {
+				return false;
+			}
+		}
+	}
+
+	// see collect_wakeups()
+	static thread_local std::vector<coroutine_handle>* collected = nullptr;
+
+	void collect_wakeups(std::vector<coroutine_handle>* handles) {
+		collected = handles;
+	}
+
+	void go(coroutine_handle handle) {
+		if (!make_ready(handle))
+			return;
+		if (collected != nullptr)
+			collected->push_back(handle);
+		else
+			scheduler_of(handle)->schedule(handle);
+	}
+
+	void go(std::span<coroutine_handle> handles) {
+		size_t count = 0;
+		for (auto handle : handles) {
+			if (make_ready(handle))
+				handles[count++] = handle;
 		}
+		if (collected != nullptr)
+			collected->insert(collected->end(), handles.begin(), handles.begin() + count);
+		else
+			schedule_all(handles.data(), count);
 	}
 }
 
@@ -286,14 +1712,66 @@ namespace coro::win32 {
 #include <linux_epoll.hpp>
 
 namespace coro::linux_epoll {
-	coro::linux_epoll::epoll_awaiter* get_epoll_awaiter() {
-		static coro::linux_epoll::epoll_awaiter* instance = nullptr;
+	static std::atomic<size_t> reactor_count = 0;
+	static std::atomic<int64_t> busy_poll_us = 0;
+
+	void set_epoll_reactor_count(size_t count) {
+		reactor_count = count;
+	}
+
+	void set_epoll_busy_poll(std::chrono::microseconds window) {
+		busy_poll_us.store(std::max<int64_t>(0, window.count()), std::memory_order_relaxed);
+	}
+
+	std::chrono::microseconds epoll_busy_poll() {
+		return std::chrono::microseconds(busy_poll_us.load(std::memory_order_relaxed));
+	}
+
+	coro::linux_epoll::epoll_reactors* get_epoll_reactors() {
+		static coro::linux_epoll::epoll_reactors* instance = nullptr;
 		static std::once_flag flag;
 		std::call_once(flag, []() {
-			instance = new coro::linux_epoll::epoll_awaiter();
+			size_t count = reactor_count.load();
+			if (count == 0)
+				count = std::max<size_t>(1, worker_count());
+			instance = new coro::linux_epoll::epoll_reactors(count);
+			std::vector<thread_awaiter*> awaiters(instance->reactors.begin(), instance->reactors.end());
+			__thread_scheduler->schedule(awaiters.data(), awaiters.size());
+			});
+		return instance;
+	}
+}
+
+namespace coro::details {
+	void add_timer(timer_node* node) {
+		auto& reactors = coro::linux_epoll::get_epoll_reactors()->reactors;
+		size_t index = current_worker_index();
+		// from outside the workers any reactor will do
+		if (index == SIZE_MAX)
+			index = 0;
+		reactors[index % reactors.size()]->add_timer(node);
+	}
+}
+
+#ifdef CORO_USE_IO_URING
+namespace coro::linux_uring {
+	uring_awaiter* get_uring_awaiter() {
+		static uring_awaiter* instance = nullptr;
+		static std::once_flag flag;
+		std::call_once(flag, []() {
+			if (getenv("LIBCORO_NO_IO_URING") != nullptr)
+				return;
+			auto ring = new uring_awaiter();
+			if (!ring->available()) {
+				// too old a kernel or blocked by seccomp, coro::net stays on epoll
+				delete ring;
+				return;
+			}
+			instance = ring;
 			__thread_scheduler->schedule(instance);
 			});
 		return instance;
 	}
 }
+#endif
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <cstdio>
+#include <sched.h>
+#include <vector>
+#include "check.hpp"
+
+using namespace std::literals;
+
+constexpr size_t workers = 3;
+
+std::vector<int> allowed;
+
+// the CPUs the calling thread may run on
+std::vector<int> thread_cpus() {
+	std::vector<int> cpus;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	sched_getaffinity(0, sizeof(set), &set);
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &set))
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+coro::task2 probe(std::atomic<int>& pinned, coro::wait_group& wg) {
+	size_t index = coro::current_worker_index();
+	// worker i sits on the i-th allowed CPU
+	std::vector<int> expected = { allowed[index % allowed.size()] };
+	if (thread_cpus() == expected)
+		pinned++;
+	wg.done();
+	co_return;
+}
+
+coro::task2 pinned_probe(coro::executor* ex, std::atomic<int>& pinned, coro::wait_group& wg) {
+	if (coro::current_executor() == ex && thread_cpus() == std::vector<int>{ allowed.back() })
+		pinned++;
+	wg.done();
+	co_return;
+}
+
+coro::task2 coro_main() {
+	CHECK(coro::worker_count() == workers);
+
+	std::atomic<int> pinned = 0;
+	coro::wait_group wg(64);
+	for (int i = 0; i < 64; i++) {
+		go(probe(pinned, wg));
+	}
+	co_await wg.wait();
+	CHECK(pinned.load() == 64);
+
+	// explicit CPU sets for an executor
+	auto ex = coro::make_executor({ .name = "pinned", .threads = 2, .cpu_sets = { { allowed.back() } } });
+	pinned = 0;
+	coro::wait_group wg2(16);
+	for (int i = 0; i < 16; i++) {
+		go(pinned_probe(ex, pinned, wg2), ex);
+	}
+	co_await wg2.wait();
+	CHECK(pinned.load() == 16);
+
+	// timers still fire with the reactor on the CPUs of a worker
+	co_await coro::sleep_for(5ms);
+}
+
+int main() {
+	allowed = thread_cpus();
+	coro::scheduler_options options;
+	options.worker_count = workers;
+	options.affinity = coro::worker_affinity::core;
+	coro::start_main_coroutine(coro_main(), options);
+	// the main thread is left alone
+	CHECK(thread_cpus() == allowed);
+	return report("affinity_test");
+}
@@ -0,0 +1,197 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <linux_epoll.hpp>
+#include <cstdio>
+#include <cstring>
+#include "check.hpp"
+
+using namespace std::literals;
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr uint16_t port = 5436;
+constexpr int connections = 200;
+
+coro::task2 lock_waiter(coro::mutex& mtx, coro::wait_group& wg) {
+	bool locked = co_await mtx.lock();
+	CHECK(!locked);
+	wg.done();
+}
+
+coro::task2 cv_waiter(coro::condition_variable& cv, coro::mutex& mtx, coro::wait_group& wg) {
+	co_await mtx.lock();
+	bool notified = co_await cv.wait(mtx);
+	CHECK(!notified);
+	// the mutex is held again, unlocking it must not hang the others
+	mtx.unlock();
+	wg.done();
+}
+
+coro::task2 wg_waiter(coro::wait_group& never, coro::wait_group& wg) {
+	bool finished = co_await never.wait();
+	CHECK(!finished);
+	wg.done();
+}
+
+coro::task2 sleeper(coro::wait_group& wg) {
+	auto start = clock_type::now();
+	bool slept = co_await coro::sleep_for(10s);
+	CHECK(!slept);
+	CHECK(clock_type::now() - start < 5s);
+	wg.done();
+}
+
+coro::task<> primitives() {
+	coro::mutex mtx;
+	coro::condition_variable cv;
+	coro::wait_group never(1);
+	coro::wait_group wg(4);
+	coro::cancellation_source source;
+
+	co_await mtx.lock();
+	go(lock_waiter(mtx, wg), source.token());
+	coro::mutex cv_mtx;
+	go(cv_waiter(cv, cv_mtx, wg), source.token());
+	go(wg_waiter(never, wg), source.token());
+	go(sleeper(wg), source.token());
+	co_await coro::sleep_for(10ms);
+
+	CHECK(source.cancel());
+	CHECK(!source.cancel());
+	CHECK(co_await wg.wait());
+
+	// the cancelled waiter left the queue, the mutex is free once unlocked
+	mtx.unlock();
+	CHECK(co_await mtx.lock());
+	mtx.unlock();
+	never.done();
+}
+
+coro::task2 session(int fd, std::atomic<int>& cancelled, coro::wait_group& wg) {
+	char buffer[64];
+	while (true) {
+		int n = co_await coro::net::recv(fd, buffer, sizeof(buffer), 0);
+		if (n <= 0) {
+			if (n < 0 && errno == ECANCELED)
+				cancelled++;
+			break;
+		}
+	}
+	coro::net::close_socket(fd);
+	wg.done();
+}
+
+coro::task2 server(int listener, std::atomic<int>& cancelled, coro::wait_group& wg) {
+	// sessions spawned from here inherit the token
+	CHECK(coro::current_cancellation_token().cancellable());
+	for (int i = 0; i < connections; i++) {
+		int fd = co_await coro::net::accept(listener, nullptr, nullptr);
+		CHECK(fd >= 0);
+		if (fd < 0)
+			break;
+		go(session(fd, cancelled, wg));
+	}
+	// waiting for a connection that never comes
+	int fd = co_await coro::net::accept(listener, nullptr, nullptr);
+	CHECK(fd == -1);
+	CHECK(errno == ECANCELED);
+	wg.done();
+}
+
+size_t pending_timers() {
+	size_t n = 0;
+	for (auto reactor : coro::linux_epoll::get_epoll_reactors()->reactors) {
+		std::lock_guard<std::mutex> lg(reactor->timers.mtx);
+		for (auto c : reactor->timers.count)
+			n += c;
+	}
+	return n;
+}
+
+coro::task<> listener_shutdown() {
+	coro::net::socket_t listener = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	CHECK(coro::net::bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0);
+	CHECK(coro::net::listen(listener, connections) == 0);
+
+	CHECK(!coro::current_cancellation_token().cancellable());
+
+	coro::cancellation_source source;
+	std::atomic<int> cancelled = 0;
+	// server + sessions
+	coro::wait_group wg(1 + connections);
+	go(server(listener, cancelled, wg), source.token());
+
+	std::vector<coro::net::socket_t> clients;
+	for (int i = 0; i < connections; i++) {
+		coro::net::socket_t sock = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		CHECK(co_await coro::net::connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0);
+		clients.push_back(sock);
+	}
+	co_await coro::sleep_for(50ms);
+	// waiting without a deadline takes no timer, cancellable or not
+	CHECK(pending_timers() == 0);
+
+	// every session is parked in recv, nothing is ever sent
+	auto start = clock_type::now();
+	source.cancel();
+	co_await wg.wait();
+	CHECK(clock_type::now() - start < 1s);
+	CHECK(cancelled == connections);
+
+	for (auto sock : clients)
+		coro::net::close_socket(sock);
+	coro::net::close_socket(listener);
+}
+
+coro::task2 deadline_reader(int fd, coro::wait_group& wg) {
+	char buffer[16];
+	int n = co_await coro::net::recv(fd, buffer, sizeof(buffer), 0, 200ms);
+	CHECK(n == -1);
+	CHECK(errno == ECANCELED);
+	wg.done();
+}
+
+// a cancelled wait with a deadline leaves no timer behind in the frame it freed
+coro::task<> deadline_and_cancel() {
+	constexpr int readers = 16;
+	int pairs[readers][2];
+	for (auto& pair : pairs) {
+		CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) == 0);
+	}
+	coro::cancellation_source source;
+	coro::wait_group wg(readers);
+	for (int i = 0; i < readers - 1; i++) {
+		go(deadline_reader(pairs[i][0], wg), source.token());
+	}
+	co_await coro::sleep_for(20ms);
+	// io_uring keeps its deadlines in the ring
+	CHECK(pending_timers() == (coro::net::use_uring() ? 0 : readers - 1));
+	source.cancel();
+	// cancelled before it waits
+	go(deadline_reader(pairs[readers - 1][0], wg), source.token());
+	co_await wg.wait();
+	CHECK(pending_timers() == 0);
+
+	// on past the deadlines, the frames of the readers are gone by now
+	co_await coro::sleep_for(300ms);
+	for (auto& pair : pairs) {
+		coro::net::close_socket(pair[0]);
+		coro::net::close_socket(pair[1]);
+	}
+}
+
+coro::task2 coro_main() {
+	co_await primitives();
+	co_await listener_shutdown();
+	co_await deadline_and_cancel();
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("cancel_test");
+}
@@ -0,0 +1,187 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <channel.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+
+using namespace std::literals;
+
+constexpr int producers = 8;
+constexpr int consumers = 4;
+constexpr int per_producer = 20000;
+
+struct message {
+	int producer;
+	int seq;
+};
+
+coro::task2 producer(int id, coro::channel<message>& ch, coro::wait_group& wg) {
+	for (int i = 0; i < per_producer; i++) {
+		bool sent = co_await ch.send(message{ id, i });
+		CHECK(sent);
+	}
+	wg.done();
+}
+
+coro::task2 consumer(coro::channel<message>& ch, std::vector<long long>& sums, std::atomic<int>& disorder, coro::wait_group& wg) {
+	int last[producers];
+	for (auto& l : last)
+		l = -1;
+	long long sum = 0;
+	message batch[16];
+	while (true) {
+		size_t n = co_await ch.recv_many(batch, 16);
+		if (n == 0)
+			break;
+		for (size_t i = 0; i < n; i++) {
+			// values of one producer arrive in the order they were sent
+			if (batch[i].seq <= last[batch[i].producer])
+				disorder++;
+			last[batch[i].producer] = batch[i].seq;
+			sum += batch[i].seq;
+		}
+	}
+	sums.push_back(sum);
+	wg.done();
+}
+
+// many producers and consumers over a channel of the given capacity
+coro::task<> traffic(size_t capacity) {
+	coro::channel<message> ch(capacity);
+	std::atomic<int> disorder = 0;
+
+	coro::wait_group sent(producers);
+	coro::wait_group received(consumers);
+	std::vector<std::vector<long long>> parts(consumers);
+	for (int i = 0; i < consumers; i++) {
+		go(consumer(ch, parts[i], disorder, received));
+	}
+	for (int i = 0; i < producers; i++) {
+		go(producer(i, ch, sent));
+	}
+	co_await sent.wait();
+	ch.close();
+	co_await received.wait();
+
+	long long total = 0;
+	for (auto& p : parts) {
+		for (auto s : p)
+			total += s;
+	}
+	CHECK(total == (long long)producers * per_producer * (per_producer - 1) / 2);
+	CHECK(disorder == 0);
+}
+
+coro::task2 late_sender(coro::channel<std::unique_ptr<int>>& ch, coro::wait_group& wg) {
+	co_await coro::sleep_for(10ms);
+	bool sent = co_await ch.send(std::make_unique<int>(42));
+	CHECK(sent);
+	wg.done();
+}
+
+coro::task2 parked_receiver(coro::channel<int>& ch, coro::wait_group& wg) {
+	auto v = co_await ch.recv();
+	CHECK(!v);
+	wg.done();
+}
+
+coro::task<> semantics() {
+	// try_* never wait
+	coro::channel<int> small(2);
+	CHECK(small.try_send(1));
+	CHECK(small.try_send(2));
+	CHECK(!small.try_send(3));
+	CHECK(small.try_recv() == 1);
+	CHECK(small.try_recv() == 2);
+	CHECK(!small.try_recv());
+
+	// values queued before close() are still delivered
+	CHECK(co_await small.send(4));
+	small.close();
+	CHECK(!small.try_send(5));
+	CHECK(!(co_await small.send(5)));
+	CHECK((co_await small.recv()) == 4);
+	CHECK(!(co_await small.recv()));
+
+	// unbuffered: a receiver takes the value straight from the parked sender, move-only values work
+	coro::channel<std::unique_ptr<int>> rendezvous(0);
+	CHECK(!rendezvous.try_send(std::make_unique<int>(1)));
+	coro::wait_group wg(1);
+	go(late_sender(rendezvous, wg));
+	auto p = co_await rendezvous.recv();
+	CHECK(p && *p && **p == 42);
+	co_await wg.wait();
+
+	// unbounded never makes a sender wait
+	coro::channel<int> unbounded;
+	for (int i = 0; i < 10000; i++) {
+		CHECK(co_await unbounded.send(i));
+	}
+	int values[64];
+	size_t n = co_await unbounded.recv_many(values, 64);
+	CHECK(n == 64);
+	CHECK(values[0] == 0 && values[63] == 63);
+
+	// parked receivers are woken by close(), and by cancellation
+	coro::channel<int> idle(4);
+	coro::wait_group closed(2);
+	go(parked_receiver(idle, closed));
+	coro::cancellation_source source;
+	go(parked_receiver(idle, closed), source.token());
+	co_await coro::sleep_for(10ms);
+	source.cancel();
+	co_await coro::sleep_for(10ms);
+	idle.close();
+	co_await closed.wait();
+}
+
+coro::task2 queued_sender(coro::channel<int>& ch, int value, coro::wait_group& wg) {
+	bool sent = co_await ch.send(value);
+	CHECK(sent);
+	wg.done();
+}
+
+// parked senders are served in order, a later send queues behind them
+coro::task<> sender_order() {
+	for (int round = 0; round < 50; round++) {
+		coro::channel<int> ch(1);
+		CHECK(ch.try_send(0));
+		coro::wait_group wg(2);
+		go(queued_sender(ch, 1, wg));
+		co_await coro::sleep_for(1ms);
+		go(queued_sender(ch, 2, wg));
+		co_await coro::sleep_for(1ms);
+		// keeps trying while the receiver below makes room
+		std::thread late([&ch]() {
+			while (!ch.try_send(3))
+				std::this_thread::yield();
+		});
+		int got[4];
+		for (auto& v : got) {
+			auto r = co_await ch.recv();
+			v = r ? *r : -1;
+		}
+		late.join();
+		co_await wg.wait();
+		CHECK(got[0] == 0 && got[1] == 1 && got[2] == 2 && got[3] == 3);
+	}
+}
+
+coro::task2 coro_main() {
+	co_await semantics();
+	co_await sender_order();
+	co_await traffic(1);
+	co_await traffic(64);
+	co_await traffic(0);
+	co_await traffic(coro::channel<message>::unbounded);
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("channel_test");
+}
@@ -0,0 +1,18 @@
+#ifndef _CORO_TEST_CHECK_H_
+#define _CORO_TEST_CHECK_H_
+
+#include <cstdio>
+
+// What the tests share: CHECK counts a failure and goes on, main ends with return report("name_test").
+
+inline int failures = 0;
+
+#define CHECK(expr) do { if (!(expr)) { printf("FAILED: %s (line %d)\n", #expr, __LINE__); failures++; } } while (0)
+
+// exit code for ctest
+inline int report(const char* name) {
+	printf("%s: %d failure(s)\n", name, failures);
+	return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <scheduler.hpp>
 #include <awaiters.hpp>
+#include <timer.hpp>
 #include <iostream>
 
 coro::task2 consumer(int cid, coro::condition_variable& cv, coro::mutex& mtx, std::queue<int>& q, coro::wait_group& wg, volatile bool& fin) {
@@ -22,7 +23,7 @@ coro::task2 consumer(int cid, coro::condition_variable& cv, coro::mutex& mtx, st
 
 coro::task2 producer(int pid, coro::condition_variable& cv, coro::mutex& mtx, std::queue<int>& q, coro::wait_group& wg) {
 	for (int i = 0; i < 10; ++i) {
-		//std::this_thread::sleep_for(std::chrono::milliseconds(40 + pid * 10));
+		co_await coro::sleep_for(std::chrono::milliseconds(1 + pid % 10));
 		co_await mtx.lock();
 		q.push(i + pid * 1000);
 		std::cout << "producer " << pid << ": " << i << std::endl;
@@ -0,0 +1,92 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <cstdio>
+#include <thread>
+#include "check.hpp"
+
+using namespace std::literals;
+
+coro::executor* cpu = nullptr;
+
+coro::task<> hop() {
+	CHECK(coro::current_executor() == coro::default_executor());
+	co_await coro::switch_to(cpu);
+	CHECK(coro::current_executor() == cpu);
+	// the default executor's workers are the ones with an index
+	CHECK(coro::current_worker_index() == SIZE_MAX);
+	// suspending on the way keeps the task where it is
+	co_await coro::sleep_for(1ms);
+	CHECK(coro::current_executor() == cpu);
+	co_await coro::switch_to(coro::default_executor());
+	CHECK(coro::current_executor() == coro::default_executor());
+	CHECK(coro::current_worker_index() != SIZE_MAX);
+}
+
+coro::task2 child(coro::executor* expected, std::atomic<int>& right, coro::wait_group& wg) {
+	if (coro::current_executor() == expected)
+		right++;
+	wg.done();
+	co_return;
+}
+
+coro::task2 parent(std::atomic<int>& right, coro::wait_group& wg) {
+	if (coro::current_executor() == cpu)
+		right++;
+	// spawned tasks start where their parent runs, unless told otherwise
+	go(child(cpu, right, wg));
+	go(child(coro::default_executor(), right, wg), coro::default_executor());
+	wg.done();
+	co_return;
+}
+
+coro::task<> spawn() {
+	std::atomic<int> right = 0;
+	coro::wait_group wg(3);
+	go(parent(right, wg), cpu);
+	co_await wg.wait();
+	CHECK(right.load() == 3);
+}
+
+coro::task2 cpu_bound(std::atomic<bool>& stop, coro::wait_group& wg) {
+	while (!stop.load()) {
+		std::this_thread::sleep_for(1ms);
+		co_await coro::yield();
+	}
+	wg.done();
+}
+
+// the busy executor does not hold up timers and wakeups of the default one
+coro::task<> isolation() {
+	std::atomic<bool> stop = false;
+	coro::wait_group wg(8);
+	for (int i = 0; i < 8; i++) {
+		go(cpu_bound(stop, wg), cpu);
+	}
+	for (int i = 0; i < 20; i++) {
+		co_await coro::sleep_for(1ms);
+		CHECK(coro::current_executor() == coro::default_executor());
+	}
+	stop = true;
+	co_await wg.wait();
+}
+
+coro::task2 coro_main() {
+	CHECK(coro::find_executor("default") == coro::default_executor());
+	coro::executor_options options;
+	options.name = "cpu";
+	options.threads = 2;
+	options.nice = 5;
+	cpu = coro::make_executor(std::move(options));
+	CHECK(coro::find_executor("cpu") == cpu);
+	CHECK(coro::find_executor("io") == nullptr);
+	co_await hop();
+	co_await spawn();
+	co_await isolation();
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("executor_test");
+}
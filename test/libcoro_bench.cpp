@@ -0,0 +1,472 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <channel.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <linux_epoll.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+Benchmarks of the scheduler, the synchronization primitives and coro::net.
+
+	libcoro_bench [-t workers] [-r repetitions] [-j file.json] [name...]
+
+Every throughput benchmark runs a fixed amount of work `repetitions` times and
+reports the median, latencies are pooled over all repetitions. Names given on
+the command line select the benchmarks whose name starts with one of them.
+Results go to stdout as a table and, with -j, to a JSON file ("-" for stdout)
+meant to be kept and compared between revisions.
+*/
+
+using namespace std::literals;
+using clock_type = std::chrono::steady_clock;
+
+struct result {
+	std::string name;
+	std::vector<std::pair<std::string, double>> values;
+};
+
+std::vector<result> results;
+std::vector<const char*> filters;
+int repetitions = 5;
+size_t workers = 0;
+
+bool selected(const char* name) {
+	if (filters.empty())
+		return true;
+	for (auto f : filters) {
+		if (strncmp(name, f, strlen(f)) == 0)
+			return true;
+	}
+	return false;
+}
+
+double ns_since(clock_type::time_point start) {
+	return std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+}
+
+double median(std::vector<double> samples) {
+	std::sort(samples.begin(), samples.end());
+	return samples[samples.size() / 2];
+}
+
+void add_percentiles(result& r, std::vector<double>& samples) {
+	std::sort(samples.begin(), samples.end());
+	auto at = [&](double q) { return samples[std::min(samples.size() - 1, (size_t)(q * samples.size()))]; };
+	r.values.push_back({ "p50_ns", at(0.5) });
+	r.values.push_back({ "p99_ns", at(0.99) });
+	r.values.push_back({ "p999_ns", at(0.999) });
+	r.values.push_back({ "max_ns", samples.back() });
+}
+
+void report(result r) {
+	printf("%-24s", r.name.c_str());
+	for (auto& [key, value] : r.values)
+		printf(" %s=%.10g", key.c_str(), value);
+	printf("\n");
+	fflush(stdout);
+	results.push_back(std::move(r));
+}
+
+// spawn + destroy
+
+coro::task2 noop(coro::wait_group& wg) {
+	wg.done();
+	co_return;
+}
+
+coro::task<> spawn() {
+	constexpr int tasks = 200000;
+	std::vector<double> samples;
+	for (int rep = 0; rep < repetitions; rep++) {
+		coro::wait_group wg(tasks);
+		auto start = clock_type::now();
+		for (int i = 0; i < tasks; i++)
+			go(noop(wg));
+		co_await wg.wait();
+		samples.push_back(ns_since(start) / tasks);
+	}
+	report({ "spawn", { { "tasks", tasks }, { "ns_per_task", median(samples) } } });
+}
+
+// go() -> resume
+
+// A coroutine parked by hand, like every awaiter of this library does it.
+struct parking_spot {
+	std::atomic<coro::coroutine_handle> handle{ nullptr };
+	clock_type::time_point woken;
+
+	struct awaiter {
+		parking_spot& spot;
+
+		bool await_ready() {
+			return false;
+		}
+
+		bool await_suspend(coro::root_handle h) {
+			coro::park(h);
+			spot.handle.store(h, std::memory_order_release);
+			return true;
+		}
+
+		void await_resume() {}
+	};
+
+	awaiter wait() {
+		return { *this };
+	}
+};
+
+coro::task2 sleeper(parking_spot& spot, int rounds, std::vector<double>& latencies, coro::wait_group& wg) {
+	for (int i = 0; i < rounds; i++) {
+		co_await spot.wait();
+		latencies.push_back(ns_since(spot.woken));
+	}
+	wg.done();
+}
+
+coro::task2 waker(parking_spot& spot, int rounds, coro::wait_group& wg) {
+	for (int i = 0; i < rounds; i++) {
+		coro::coroutine_handle h = nullptr;
+		while (!(h = spot.handle.exchange(nullptr, std::memory_order_acquire)))
+			co_await coro::yield();
+		spot.woken = clock_type::now();
+		go(h);
+		co_await coro::yield();
+	}
+	wg.done();
+}
+
+coro::task<> go_resume() {
+	constexpr int rounds = 20000;
+	std::vector<double> latencies;
+	latencies.reserve(rounds * repetitions);
+	for (int rep = 0; rep < repetitions; rep++) {
+		parking_spot spot;
+		coro::wait_group wg(2);
+		go(sleeper(spot, rounds, latencies, wg));
+		go(waker(spot, rounds, wg));
+		co_await wg.wait();
+	}
+	result r{ "go_resume", { { "rounds", rounds } } };
+	add_percentiles(r, latencies);
+	report(std::move(r));
+}
+
+// ping-pong
+
+coro::task2 pong(coro::channel<int>& in, coro::channel<int>& out, coro::wait_group& wg) {
+	while (true) {
+		auto value = co_await in.recv();
+		if (!value)
+			break;
+		co_await out.send(*value);
+	}
+	wg.done();
+}
+
+coro::task<> ping_pong() {
+	constexpr int rounds = 100000;
+	std::vector<double> samples;
+	for (int rep = 0; rep < repetitions; rep++) {
+		coro::channel<int> ping(1), back(1);
+		coro::wait_group wg(1);
+		go(pong(ping, back, wg));
+		auto start = clock_type::now();
+		for (int i = 0; i < rounds; i++) {
+			co_await ping.send(i);
+			co_await back.recv();
+		}
+		samples.push_back(ns_since(start) / rounds);
+		ping.close();
+		co_await wg.wait();
+	}
+	report({ "ping_pong", { { "rounds", rounds }, { "ns_per_round_trip", median(samples) } } });
+}
+
+// mutex fan-in
+
+long long counter = 0;
+
+coro::task2 contender(coro::mutex& mtx, int n, coro::wait_group& wg) {
+	for (int i = 0; i < n; i++) {
+		co_await mtx.lock();
+		counter++;
+		if (i % 16 == 0)
+			co_await coro::yield();
+		mtx.unlock();
+	}
+	wg.done();
+}
+
+coro::task<> mutex_fan_in(coro::mutex_mode mode, int contenders) {
+	constexpr int ops = 200000;
+	std::vector<double> samples;
+	for (int rep = 0; rep < repetitions; rep++) {
+		coro::mutex mtx(mode);
+		coro::wait_group wg(contenders);
+		auto start = clock_type::now();
+		for (int i = 0; i < contenders; i++)
+			go(contender(mtx, ops / contenders, wg));
+		co_await wg.wait();
+		samples.push_back(ns_since(start) / (ops / contenders * contenders));
+	}
+	std::string name = mode == coro::mutex_mode::handoff ? "mutex_handoff" : "mutex_barging";
+	report({ name + "/" + std::to_string(contenders), { { "contenders", contenders }, { "ns_per_lock", median(samples) } } });
+}
+
+// condition_variable / wait_group fan-out
+
+struct gate {
+	coro::mutex mtx;
+	coro::condition_variable cv;
+	int waiting = 0;
+	bool open = false;
+};
+
+coro::task2 cv_waiter(gate& g, coro::wait_group& wg) {
+	co_await g.mtx.lock();
+	g.waiting++;
+	while (!g.open)
+		co_await g.cv.wait(g.mtx);
+	g.mtx.unlock();
+	wg.done();
+}
+
+coro::task<> cv_fan_out(int waiters) {
+	constexpr int rounds = 200;
+	std::vector<double> latencies;
+	for (int round = 0; round < rounds; round++) {
+		gate g;
+		coro::wait_group wg(waiters);
+		for (int i = 0; i < waiters; i++)
+			go(cv_waiter(g, wg));
+		// everybody who counted itself in has released the mutex in cv.wait()
+		while (true) {
+			co_await g.mtx.lock();
+			if (g.waiting == waiters)
+				break;
+			g.mtx.unlock();
+			co_await coro::yield();
+		}
+		g.open = true;
+		auto start = clock_type::now();
+		g.cv.notify_all();
+		g.mtx.unlock();
+		co_await wg.wait();
+		latencies.push_back(ns_since(start));
+	}
+	result r{ "cv_fan_out/" + std::to_string(waiters), { { "waiters", waiters } } };
+	add_percentiles(r, latencies);
+	report(std::move(r));
+}
+
+coro::task2 wg_waiter(coro::wait_group& started, coro::wait_group& gate, coro::wait_group& wg) {
+	started.done();
+	co_await gate.wait();
+	wg.done();
+}
+
+coro::task<> wg_fan_out(int waiters) {
+	constexpr int rounds = 200;
+	std::vector<double> latencies;
+	for (int round = 0; round < rounds; round++) {
+		coro::wait_group started(waiters), gate(1), wg(waiters);
+		for (int i = 0; i < waiters; i++)
+			go(wg_waiter(started, gate, wg));
+		co_await started.wait();
+		// let the last ones get from done() into gate.wait()
+		co_await coro::sleep_for(200us);
+		auto start = clock_type::now();
+		gate.done();
+		co_await wg.wait();
+		latencies.push_back(ns_since(start));
+	}
+	result r{ "wg_fan_out/" + std::to_string(waiters), { { "waiters", waiters } } };
+	add_percentiles(r, latencies);
+	report(std::move(r));
+}
+
+// loopback TCP echo
+
+constexpr size_t message_size = 64;
+
+coro::task2 echo_session(coro::net::socket_t sock) {
+	char buffer[4096];
+	while (true) {
+		int received = co_await coro::net::recv(sock, buffer, sizeof(buffer), 0);
+		if (received <= 0)
+			break;
+		int sent = co_await coro::net::send(sock, buffer, received, 0);
+		if (sent != received)
+			break;
+	}
+	coro::net::close_socket(sock);
+}
+
+coro::task2 echo_server(coro::net::socket_t listener) {
+	while (true) {
+		coro::net::socket_t client = co_await coro::net::accept(listener, nullptr, nullptr);
+		if (client == coro::net::invalid_socket)
+			break;
+		go(echo_session(client), coro::cancellation_token());
+	}
+}
+
+coro::task2 echo_client(sockaddr_in addr, int requests, std::vector<double>& latencies, coro::wait_group& wg) {
+	coro::net::socket_t sock = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	int connected = co_await coro::net::connect(sock, (sockaddr*)&addr, sizeof(addr), 5s);
+	if (connected == 0) {
+		char request[message_size], reply[message_size];
+		memset(request, 'x', sizeof(request));
+		for (int i = 0; i < requests; i++) {
+			auto start = clock_type::now();
+			int sent = co_await coro::net::send(sock, request, sizeof(request), 0);
+			if (sent != (int)sizeof(request))
+				break;
+			size_t got = 0;
+			while (got < sizeof(reply)) {
+				int received = co_await coro::net::recv(sock, reply + got, sizeof(reply) - got, 0);
+				if (received <= 0)
+					break;
+				got += received;
+			}
+			if (got < sizeof(reply))
+				break;
+			latencies.push_back(ns_since(start));
+		}
+	}
+	else {
+		printf("echo: connect failed\n");
+	}
+	coro::net::close_socket(sock);
+	wg.done();
+}
+
+coro::task<> echo(int connections) {
+	constexpr int requests = 2000;
+	coro::net::socket_t listener = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	socklen_t len = sizeof(addr);
+	if (coro::net::bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || coro::net::listen(listener, 128) != 0 ||
+		getsockname(listener, (sockaddr*)&addr, &len) != 0) {
+		printf("echo: failed to listen on 127.0.0.1\n");
+		coro::net::close_socket(listener);
+		co_return;
+	}
+
+	coro::cancellation_source stop;
+	go(echo_server(listener), stop.token());
+
+	std::vector<std::vector<double>> per_client(connections);
+	std::vector<double> throughput;
+	for (int rep = 0; rep < repetitions; rep++) {
+		coro::wait_group wg(connections);
+		size_t before = 0;
+		for (auto& l : per_client)
+			before += l.size();
+		auto start = clock_type::now();
+		for (int i = 0; i < connections; i++)
+			go(echo_client(addr, requests, per_client[i], wg));
+		co_await wg.wait();
+		double elapsed = ns_since(start);
+		size_t after = 0;
+		for (auto& l : per_client)
+			after += l.size();
+		throughput.push_back((after - before) * 1e9 / elapsed);
+	}
+	stop.cancel();
+	coro::net::close_socket(listener);
+
+	std::vector<double> latencies;
+	for (auto& l : per_client)
+		latencies.insert(latencies.end(), l.begin(), l.end());
+	result r{ "echo/" + std::to_string(connections), { { "connections", connections }, { "message_bytes", message_size } } };
+	if (latencies.empty()) {
+		printf("echo: no request completed\n");
+		co_return;
+	}
+	r.values.push_back({ "requests_per_s", median(throughput) });
+	add_percentiles(r, latencies);
+	report(std::move(r));
+}
+
+coro::task2 coro_main() {
+	workers = coro::worker_count();
+	if (selected("spawn"))
+		co_await spawn();
+	if (selected("go_resume"))
+		co_await go_resume();
+	if (selected("ping_pong"))
+		co_await ping_pong();
+	for (auto mode : { coro::mutex_mode::handoff, coro::mutex_mode::barging }) {
+		for (int contenders : { 1, 8, 64 }) {
+			if (selected(mode == coro::mutex_mode::handoff ? "mutex_handoff" : "mutex_barging"))
+				co_await mutex_fan_in(mode, contenders);
+		}
+	}
+	for (int waiters : { 1, 16, 256 }) {
+		if (selected("cv_fan_out"))
+			co_await cv_fan_out(waiters);
+		if (selected("wg_fan_out"))
+			co_await wg_fan_out(waiters);
+	}
+	for (int connections : { 1, 16, 64 }) {
+		if (selected("echo"))
+			co_await echo(connections);
+	}
+}
+
+void write_json(FILE* out) {
+	fprintf(out, "{\n  \"workers\": %zu,\n  \"repetitions\": %d,\n  \"results\": [\n", workers, repetitions);
+	for (size_t i = 0; i < results.size(); i++) {
+		fprintf(out, "    { \"name\": \"%s\"", results[i].name.c_str());
+		for (auto& [key, value] : results[i].values)
+			fprintf(out, ", \"%s\": %.10g", key.c_str(), value);
+		fprintf(out, " }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+	const char* json = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			workers = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			repetitions = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			json = argv[++i];
+		else if (argv[i][0] == '-') {
+			printf("usage: %s [-t workers] [-r repetitions] [-j file.json] [name...]\n", argv[0]);
+			return 1;
+		}
+		else
+			filters.push_back(argv[i]);
+	}
+
+	coro::scheduler_options options;
+	options.worker_count = workers;
+	coro::start_main_coroutine(coro_main(), options);
+
+	if (json) {
+		FILE* out = strcmp(json, "-") == 0 ? stdout : fopen(json, "w");
+		if (!out) {
+			printf("cannot write %s\n", json);
+			return 1;
+		}
+		write_json(out);
+		if (out != stdout)
+			fclose(out);
+	}
+	return 0;
+}
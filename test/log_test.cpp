@@ -0,0 +1,160 @@
+#include <log.hpp>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+
+std::mutex lines_mtx;
+std::vector<std::string> lines;
+
+void capture(coro::log::level, const char* line) {
+	std::lock_guard<std::mutex> lg(lines_mtx);
+	lines.push_back(line);
+}
+
+// the message, without the time, thread and level in front
+std::string message(size_t i) {
+	std::lock_guard<std::mutex> lg(lines_mtx);
+	if (i >= lines.size())
+		return "";
+	auto& line = lines[i];
+	size_t time_end = line.find(' ', line.find_first_not_of(' '));
+	size_t thread_end = line.find(' ', time_end + 1);
+	// the level is padded to five
+	return line.substr(thread_end + 1 + 6);
+}
+
+void clear() {
+	std::lock_guard<std::mutex> lg(lines_mtx);
+	lines.clear();
+}
+
+size_t line_count() {
+	std::lock_guard<std::mutex> lg(lines_mtx);
+	return lines.size();
+}
+
+int evaluated = 0;
+
+int side_effect() {
+	return ++evaluated;
+}
+
+void formatting() {
+	clear();
+	size_t size = 42;
+	std::string name = "reactor";
+	CORO_LOG(info, "plain");
+	CORO_LOG(info, "%d %u %zu %ld %x", -5, 7u, size, -3L, 255);
+	CORO_LOG(warn, "[%5d] [%-4s] [%.2f] [%c] 100%%", 12, "ab", 3.14159, 'z');
+	CORO_LOG(error, "%s on %s", name.c_str(), "fd");
+	coro::log::flush();
+	CHECK(line_count() == 4);
+	CHECK(message(0) == "plain");
+	CHECK(message(1) == "-5 7 42 -3 ff");
+	CHECK(message(2) == "[   12] [ab  ] [3.14] [z] 100%");
+	CHECK(message(3) == "reactor on fd");
+	{
+		std::lock_guard<std::mutex> lg(lines_mtx);
+		CHECK(lines.size() == 4 && lines[0].find("INFO") != std::string::npos);
+		CHECK(lines.size() == 4 && lines[3].find("ERROR") != std::string::npos);
+	}
+
+	// strings are copied, the buffer may go away right after
+	clear();
+	{
+		char buffer[16];
+		strcpy(buffer, "gone");
+		CORO_LOG(info, "%s", buffer);
+		strcpy(buffer, "changed");
+	}
+	coro::log::flush();
+	CHECK(message(0) == "gone");
+}
+
+void levels() {
+	clear();
+	evaluated = 0;
+	// below the default CORO_LOG_LEVEL, not even the arguments are evaluated
+	CORO_LOG(trace, "%d", side_effect());
+	CHECK(evaluated == 0);
+	CHECK(!coro::log::compiled_in(coro::log::level::trace));
+	CHECK(coro::log::compiled_in(coro::log::level::error));
+
+	coro::log::set_level(coro::log::level::warn);
+	CORO_LOG(info, "dropped %d", side_effect());
+	CORO_LOG(warn, "kept");
+	coro::log::set_level(coro::log::level::trace);
+	coro::log::flush();
+	CHECK(line_count() == 1);
+	CHECK(message(0) == "kept");
+}
+
+void threads() {
+	clear();
+	constexpr int count = 4;
+	constexpr int per_thread = 100;
+	uint64_t dropped = coro::log::dropped();
+	std::vector<std::thread> writers;
+	for (int t = 0; t < count; t++) {
+		writers.emplace_back([t]() {
+			for (int i = 0; i < per_thread; i++)
+				CORO_LOG(info, "thread %d line %d", t, i);
+		});
+	}
+	for (auto& w : writers)
+		w.join();
+	coro::log::flush();
+	// a ring holds more than per_thread records, nothing is lost
+	CHECK(coro::log::dropped() == dropped);
+	CHECK(line_count() == count * per_thread);
+
+	// more than a ring holds between two rounds of the writer thread
+	clear();
+	std::thread([]() {
+		for (int i = 0; i < 5000; i++)
+			CORO_LOG(info, "burst %d", i);
+	}).join();
+	coro::log::flush();
+	CHECK(line_count() + (coro::log::dropped() - dropped) == 5000);
+}
+
+void print(coro::log::level, const char* line) {
+	printf("%s\n", line);
+}
+
+// a record that wakes nobody still goes out when the program exits
+void at_exit(const char* self) {
+#ifndef _WIN32
+	std::string command = std::string(self) + " exit";
+	FILE* child = popen(command.c_str(), "r");
+	CHECK(child != nullptr);
+	if (child == nullptr)
+		return;
+	std::string output;
+	char buffer[256];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), child)) > 0)
+		output.append(buffer, n);
+	CHECK(pclose(child) == 0);
+	CHECK(output.find("last words") != std::string::npos);
+#endif
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && strcmp(argv[1], "exit") == 0) {
+		coro::log::set_sink(print);
+		CORO_LOG(info, "last words");
+		return 0;
+	}
+	coro::log::set_sink(capture);
+	formatting();
+	levels();
+	threads();
+	at_exit(argv[0]);
+	coro::log::set_sink(nullptr);
+	return report("log_test");
+}
@@ -0,0 +1,126 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <linux_epoll.hpp>
+#include <metrics.hpp>
+#include <cstdio>
+#include <cstring>
+#include "check.hpp"
+
+using namespace std::literals;
+
+using coro::metrics::event;
+using coro::metrics::series;
+
+void histograms() {
+	coro::metrics::histogram h;
+	CHECK(h.quantile(0.5) == 0);
+	CHECK(coro::metrics::histogram::bucket_of(0) == 0);
+	CHECK(coro::metrics::histogram::bucket_of(1) == 1);
+	CHECK(coro::metrics::histogram::bucket_of(1000) == 10);
+	CHECK(coro::metrics::histogram::bucket_of(UINT64_MAX) == coro::metrics::histogram::bucket_count - 1);
+
+	// 90 values of 100 and 10 of 5000
+	h.buckets[coro::metrics::histogram::bucket_of(100)] = 90;
+	h.buckets[coro::metrics::histogram::bucket_of(5000)] = 10;
+	h.count = 100;
+	h.sum = 90 * 100 + 10 * 5000;
+	h.max = 5000;
+	CHECK(h.quantile(0.5) == 127);
+	CHECK(h.quantile(0.89) == 127);
+	CHECK(h.quantile(0.95) == 5000);
+	CHECK(h.mean() == 590.0);
+
+	coro::metrics::histogram other;
+	other.merge(h);
+	other.merge(h);
+	CHECK(other.count == 200);
+	CHECK(other.max == 5000);
+	CHECK(other.quantile(0.5) == 127);
+}
+
+coro::task2 finisher(coro::wait_group& wg) {
+	co_await coro::yield();
+	wg.done();
+}
+
+coro::task<> tasks() {
+	auto before = coro::metrics::snapshot();
+	coro::wait_group wg(100);
+	for (int i = 0; i < 100; i++) {
+		go(finisher(wg));
+	}
+	// parked until the last one is done
+	co_await wg.wait();
+	co_await coro::sleep_for(10ms);
+
+	auto after = coro::metrics::snapshot();
+	CHECK(after.total[event::spawned] - before.total[event::spawned] >= 100);
+	CHECK(after.total[event::destroyed] - before.total[event::destroyed] >= 100);
+	// every one of them ran twice, around its yield
+	CHECK(after.total[event::resumed] - before.total[event::resumed] >= 200);
+	CHECK(after.total[event::parked] > before.total[event::parked]);
+	// one wakeup in queue_sample_rate
+	CHECK(after.total[series::queue_ns].count - before.total[series::queue_ns].count >= 200 / coro::metrics::queue_sample_rate - 2);
+	// this task is still alive
+	CHECK(after.alive >= 1);
+	CHECK(after.workers.size() == coro::worker_count());
+	uint64_t resumed = 0;
+	for (auto& w : after.workers)
+		resumed += w[event::resumed];
+	CHECK(resumed >= 200);
+}
+
+coro::task<> sockets() {
+	coro::net::socket_t listener = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	socklen_t len = sizeof(addr);
+	CHECK(coro::net::bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0);
+	CHECK(coro::net::listen(listener, 4) == 0);
+	CHECK(getsockname(listener, (sockaddr*)&addr, &len) == 0);
+
+	auto before = coro::metrics::snapshot();
+	coro::net::socket_t client = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	int connected = co_await coro::net::connect(client, (sockaddr*)&addr, sizeof(addr), 1s);
+	CHECK(connected == 0);
+	coro::net::socket_t server = co_await coro::net::accept(listener, nullptr, nullptr, 1s);
+	CHECK(server >= 0);
+
+	char buffer[16] = {};
+	for (int i = 0; i < 10; i++) {
+		int sent = co_await coro::net::send(client, "ping", 4, 0);
+		CHECK(sent == 4);
+		int received = co_await coro::net::recv(server, buffer, sizeof(buffer), 0, 1s);
+		CHECK(received == 4);
+	}
+
+	auto after = coro::metrics::snapshot();
+	CHECK(after.total[series::send_ns].count - before.total[series::send_ns].count == 10);
+	CHECK(after.total[series::recv_ns].count - before.total[series::recv_ns].count == 10);
+	CHECK(after.total[series::recv_ns].max > 0);
+	CHECK(after.total[event::reactor_wakeup] > 0);
+	CHECK(after.total[series::reactor_batch].count > 0);
+
+	coro::net::close_socket(client);
+	coro::net::close_socket(server);
+	coro::net::close_socket(listener);
+}
+
+coro::task2 coro_main() {
+	co_await tasks();
+	co_await sockets();
+}
+
+int main() {
+	histograms();
+	coro::start_main_coroutine(coro_main());
+	// the workers exited, what they counted was kept
+	auto s = coro::metrics::snapshot();
+	CHECK(s.workers.empty());
+	CHECK(s.total[event::destroyed] >= 100);
+	return report("metrics_test");
+}
@@ -0,0 +1,105 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <chrono>
+#include <cstdio>
+#include <queue>
+
+/*
+coro::mutex in both modes against the spin_lock + std::queue mutex it
+replaced, kept here as legacy_mutex. Every contender locks `ops / contenders`
+times and suspends inside the lock now and then, so the others queue up.
+*/
+
+struct legacy_mutex {
+	coro::spin_lock waiters_lock;
+	std::atomic_flag flag;
+	std::queue<coro::coroutine_handle> waiters;
+
+	legacy_mutex() {
+		flag.clear();
+	}
+
+	struct lock_awaiter {
+		legacy_mutex& m;
+
+		bool await_ready() {
+			return !m.flag.test_and_set(std::memory_order_acquire);
+		}
+
+		bool await_suspend(coro::root_handle h) {
+			std::lock_guard<coro::spin_lock> lg(m.waiters_lock);
+			if (m.flag.test_and_set(std::memory_order_acquire)) {
+				coro::park(h);
+				m.waiters.push(h);
+				return true;
+			}
+			return false;
+		}
+
+		bool await_resume() {
+			return true;
+		}
+	};
+
+	lock_awaiter lock() {
+		return { *this };
+	}
+
+	void unlock() {
+		std::lock_guard<coro::spin_lock> lg(waiters_lock);
+		if (!waiters.empty()) {
+			auto h = waiters.front();
+			waiters.pop();
+			coro::go(h);
+		}
+		else {
+			flag.clear(std::memory_order_release);
+		}
+	}
+};
+
+constexpr int ops = 400000;
+
+long long counter = 0;
+
+template<typename _Mutex>
+coro::task2 contender(_Mutex& mtx, int n, coro::wait_group& wg) {
+	for (int i = 0; i < n; i++) {
+		co_await mtx.lock();
+		counter++;
+		if (i % 16 == 0)
+			co_await coro::yield();
+		mtx.unlock();
+	}
+	wg.done();
+}
+
+template<typename _Mutex, typename... _Args>
+coro::task<double> run(int contenders, _Args... args) {
+	_Mutex mtx(args...);
+	coro::wait_group wg(contenders);
+	counter = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < contenders; i++) {
+		go(contender(mtx, ops / contenders, wg));
+	}
+	co_await wg.wait();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	co_return std::chrono::duration<double, std::nano>(elapsed).count() / (ops / contenders * contenders);
+}
+
+coro::task2 coro_main() {
+	printf("%-12s %12s %12s %12s\n", "contenders", "legacy", "handoff", "barging");
+	for (int contenders : { 1, 8, 64 }) {
+		double legacy = co_await run<legacy_mutex>(contenders);
+		double handoff = co_await run<coro::mutex>(contenders, coro::mutex_mode::handoff);
+		double barging = co_await run<coro::mutex>(contenders, coro::mutex_mode::barging);
+		printf("%-12d %9.1f ns %9.1f ns %9.1f ns\n", contenders, legacy, handoff, barging);
+	}
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return 0;
+}
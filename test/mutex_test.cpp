@@ -0,0 +1,129 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <cstdio>
+#include <vector>
+#include "check.hpp"
+
+using namespace std::literals;
+
+constexpr int contenders = 64;
+constexpr int rounds = 2000;
+
+coro::task2 incrementer(coro::mutex& mtx, long long& value, coro::wait_group& wg) {
+	for (int i = 0; i < rounds; i++) {
+		bool locked = co_await mtx.lock();
+		CHECK(locked);
+		long long v = value;
+		// give the others a chance to pile up behind the lock
+		if (i % 7 == 0)
+			co_await coro::yield();
+		value = v + 1;
+		mtx.unlock();
+	}
+	wg.done();
+}
+
+coro::task<> contention(coro::mutex_mode mode) {
+	coro::mutex mtx(mode);
+	long long value = 0;
+	coro::wait_group wg(contenders);
+	for (int i = 0; i < contenders; i++) {
+		go(incrementer(mtx, value, wg));
+	}
+	co_await wg.wait();
+	CHECK(value == (long long)contenders * rounds);
+	CHECK(mtx.try_lock());
+	mtx.unlock();
+}
+
+coro::task2 queued_locker(coro::mutex& mtx, int id, std::vector<int>& order, coro::wait_group& started, coro::wait_group& wg) {
+	started.done();
+	co_await mtx.lock();
+	order.push_back(id);
+	mtx.unlock();
+	wg.done();
+}
+
+// handoff: waiters get the lock in the order they queued
+coro::task<> fifo() {
+	coro::mutex mtx;
+	std::vector<int> order;
+	coro::wait_group wg(8);
+	co_await mtx.lock();
+	CHECK(!mtx.try_lock());
+	for (int i = 0; i < 8; i++) {
+		coro::wait_group started(1);
+		go(queued_locker(mtx, i, order, started, wg));
+		co_await started.wait();
+		co_await coro::sleep_for(5ms);
+	}
+	mtx.unlock();
+	co_await wg.wait();
+	CHECK(order.size() == 8);
+	for (int i = 0; i < (int)order.size(); i++) {
+		CHECK(order[i] == i);
+	}
+}
+
+coro::task2 one_locker(coro::mutex& mtx, coro::wait_group& wg) {
+	co_await mtx.lock();
+	mtx.unlock();
+	wg.done();
+}
+
+// unlock() with a waiter: handoff keeps the lock taken for it, barging lets it go
+coro::task<> handover(coro::mutex_mode mode) {
+	coro::mutex mtx(mode);
+	coro::wait_group wg(1);
+	co_await mtx.lock();
+	go(one_locker(mtx, wg));
+	co_await coro::sleep_for(10ms);
+	mtx.unlock();
+	bool taken = mtx.try_lock();
+	CHECK(taken == (mode == coro::mutex_mode::barging));
+	if (taken) {
+		co_await coro::sleep_for(5ms);
+		mtx.unlock();
+	}
+	co_await wg.wait();
+}
+
+coro::task2 cancelled_locker(coro::mutex& mtx, coro::wait_group& wg) {
+	bool locked = co_await mtx.lock();
+	CHECK(!locked);
+	wg.done();
+}
+
+coro::task<> cancel(coro::mutex_mode mode) {
+	coro::mutex mtx(mode);
+	coro::cancellation_source source;
+	coro::wait_group wg(16);
+	co_await mtx.lock();
+	for (int i = 0; i < 16; i++) {
+		go(cancelled_locker(mtx, wg), source.token());
+	}
+	co_await coro::sleep_for(10ms);
+	source.cancel();
+	co_await wg.wait();
+	// nobody is left in the queue
+	mtx.unlock();
+	CHECK(mtx.try_lock());
+	mtx.unlock();
+}
+
+coro::task2 coro_main() {
+	co_await contention(coro::mutex_mode::handoff);
+	co_await contention(coro::mutex_mode::barging);
+	co_await fifo();
+	co_await handover(coro::mutex_mode::handoff);
+	co_await handover(coro::mutex_mode::barging);
+	co_await cancel(coro::mutex_mode::handoff);
+	co_await cancel(coro::mutex_mode::barging);
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("mutex_test");
+}
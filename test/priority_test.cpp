@@ -0,0 +1,74 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "check.hpp"
+
+using namespace std::literals;
+
+constexpr int bulk_tasks = 200;
+
+coro::spin_lock order_lock;
+std::vector<int> order;
+
+void record(int id) {
+	std::lock_guard<coro::spin_lock> lg(order_lock);
+	order.push_back(id);
+}
+
+size_t position(int id) {
+	std::lock_guard<coro::spin_lock> lg(order_lock);
+	for (size_t i = 0; i < order.size(); i++) {
+		if (order[i] == id)
+			return i;
+	}
+	return SIZE_MAX;
+}
+
+void spin(std::chrono::microseconds time) {
+	auto end = std::chrono::steady_clock::now() + time;
+	while (std::chrono::steady_clock::now() < end) {
+	}
+}
+
+coro::task2 bulk(int id, coro::wait_group& wg) {
+	spin(50us);
+	record(id);
+	co_await coro::yield();
+	spin(50us);
+	record(id);
+	wg.done();
+}
+
+coro::task2 urgent(coro::wait_group& wg) {
+	record(-1);
+	// the priority stays with the task for its next wakeup
+	co_await coro::yield();
+	record(-2);
+	wg.done();
+}
+
+// a high priority task runs ahead of the normal ones that are ready before it
+coro::task<> jump_ahead() {
+	coro::wait_group wg(bulk_tasks + 1);
+	for (int i = 0; i < bulk_tasks; i++) {
+		go(bulk(i, wg));
+	}
+	go(urgent(wg), coro::task_priority::high);
+	co_await wg.wait();
+	CHECK(order.size() == 2 * bulk_tasks + 2);
+	CHECK(position(-1) < bulk_tasks / 2);
+	CHECK(position(-2) < bulk_tasks / 2);
+}
+
+coro::task2 coro_main() {
+	co_await jump_ahead();
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("priority_test");
+}
@@ -0,0 +1,274 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <linux_epoll.hpp>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+
+using namespace std::literals;
+
+constexpr uint16_t port = 5434;
+constexpr int connections = 16;
+constexpr int messages = 200;
+// more than the smallest event array, so a turn of a reactor can fill it
+constexpr int pairs = 512;
+
+coro::task2 echo_session(int fd, coro::wait_group& wg) {
+	char buffer[256];
+	while (true) {
+		int n = co_await coro::net::recv(fd, buffer, sizeof(buffer), 0);
+		if (n <= 0)
+			break;
+		co_await coro::net::send(fd, buffer, n, 0);
+	}
+	coro::net::close_socket(fd);
+	wg.done();
+}
+
+coro::task2 server(int listener, coro::wait_group& wg) {
+	for (int i = 0; i < connections; i++) {
+		int fd = co_await coro::net::accept(listener, nullptr, nullptr);
+		CHECK(fd >= 0);
+		if (fd < 0)
+			break;
+		go(echo_session(fd, wg));
+	}
+	wg.done();
+}
+
+coro::task2 client(int id, coro::wait_group& wg) {
+	coro::net::socket_t sock = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	int connected = co_await coro::net::connect(sock, (sockaddr*)&addr, sizeof(addr));
+	CHECK(connected == 0);
+
+	for (int i = 0; i < messages; i++) {
+		char message[32];
+		int len = snprintf(message, sizeof(message), "client %d message %d", id, i);
+		int sent = co_await coro::net::send(sock, message, len, 0);
+		CHECK(sent == len);
+
+		char reply[32] = {};
+		int received = co_await coro::net::recv(sock, reply, len, MSG_WAITALL);
+		CHECK(received == len);
+		CHECK(memcmp(message, reply, len) == 0);
+	}
+	coro::net::close_socket(sock);
+	wg.done();
+}
+
+coro::task2 receiver(int fd, coro::wait_group& wg) {
+	char c = 0;
+	int n = co_await coro::net::recv(fd, &c, 1, 0);
+	CHECK(n == 1 && c == 'x');
+	wg.done();
+}
+
+// every socket of a batch becomes readable at about the same time
+coro::task<> batch() {
+	std::vector<int> fds(pairs * 2);
+	for (int i = 0; i < pairs; i++) {
+		CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, &fds[i * 2]) == 0);
+	}
+	coro::wait_group wg(pairs);
+	for (int i = 0; i < pairs; i++) {
+		go(receiver(fds[i * 2], wg));
+	}
+	co_await coro::sleep_for(10ms);
+	for (int i = 0; i < pairs; i++) {
+		CHECK(::write(fds[i * 2 + 1], "x", 1) == 1);
+	}
+	co_await wg.wait();
+	for (int fd : fds) {
+		coro::net::close_socket(fd);
+	}
+
+	for (auto reactor : coro::linux_epoll::get_epoll_reactors()->reactors) {
+		CHECK(reactor->events.size() >= coro::linux_epoll::epoll_awaiter::min_events);
+		CHECK(reactor->events.size() <= coro::linux_epoll::epoll_awaiter::max_events);
+	}
+}
+
+coro::task2 parked_recv(int fd, int& result, int& error, coro::wait_group& wg) {
+	char c = 0;
+	result = co_await coro::net::recv(fd, &c, 1, 0);
+	error = errno;
+	wg.done();
+}
+
+// close_socket() resumes a recv parked on the fd
+coro::task<> close_while_parked() {
+	// a pending io_uring recv holds on to the file instead
+	if (coro::net::use_uring())
+		co_return;
+	int fds[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+	int result = 0;
+	int error = 0;
+	coro::wait_group wg(1);
+	go(parked_recv(fds[0], result, error, wg));
+	co_await coro::sleep_for(10ms);
+	coro::net::close_socket(fds[0]);
+	co_await wg.wait();
+	CHECK(result == -1);
+	CHECK(error == EBADF);
+	coro::net::close_socket(fds[1]);
+}
+
+struct never_parked : coro::linux_epoll::epoll_operation {};
+
+// an operation that got the registration before unregister() must not park on it
+void closed_slot() {
+	int fds[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+	auto reactors = coro::linux_epoll::get_epoll_reactors();
+	auto reg = reactors->registration(fds[0]);
+	reactors->unregister(fds[0]);
+	never_parked op;
+	int tries = 0;
+	int error = 0;
+	auto try_op = [&]() { tries++; return coro::linux_epoll::io_attempt::blocked; };
+	CHECK(!reg->try_ready(reg->reader, try_op));
+	CHECK(!reg->arm(reg->reader, &op, try_op, error));
+	CHECK(error == EBADF);
+	CHECK(tries == 0);
+	// a late event leaves it closed
+	reg->on_event(EPOLLIN);
+	CHECK(!reg->arm(reg->reader, &op, try_op, error));
+	CHECK(error == EBADF);
+	// registered again, it starts over
+	CHECK(reactors->registration(fds[0]) == reg);
+	CHECK(reg->arm(reg->reader, &op, try_op, error));
+	CHECK(tries == 1);
+	uintptr_t expected = (uintptr_t)static_cast<coro::linux_epoll::epoll_operation*>(&op);
+	CHECK(reg->reader.compare_exchange_strong(expected, coro::linux_epoll::epoll_registration::idle));
+	coro::net::close_socket(fds[0]);
+	coro::net::close_socket(fds[1]);
+}
+
+coro::task2 acceptor(int listener, int& result, int& error, coro::wait_group& wg) {
+	result = co_await coro::net::accept(listener, nullptr, nullptr, 1s);
+	error = errno;
+	wg.done();
+}
+
+// two accepts on one listener at once
+coro::task<> double_accept() {
+	coro::net::socket_t listener = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0;
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	socklen_t len = sizeof(addr);
+	CHECK(coro::net::bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0);
+	CHECK(coro::net::listen(listener, 4) == 0);
+	CHECK(getsockname(listener, (sockaddr*)&addr, &len) == 0);
+
+	int results[2] = { -1, -1 };
+	int errors[2] = {};
+	coro::wait_group wg(2);
+	go(acceptor(listener, results[0], errors[0], wg));
+	go(acceptor(listener, results[1], errors[1], wg));
+	co_await coro::sleep_for(10ms);
+	coro::net::socket_t clients[2];
+	for (auto& client : clients) {
+		client = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		int connected = co_await coro::net::connect(client, (sockaddr*)&addr, sizeof(addr), 1s);
+		CHECK(connected == 0);
+	}
+	co_await wg.wait();
+
+	// epoll parks one waiter per direction and turns the other one away, io_uring takes both
+	int accepted = 0;
+	for (int i = 0; i < 2; i++) {
+		if (results[i] >= 0) {
+			accepted++;
+			coro::net::close_socket(results[i]);
+		}
+		else {
+			CHECK(errors[i] == EBUSY);
+		}
+	}
+	CHECK(accepted == (coro::net::use_uring() ? 2 : 1));
+	for (auto client : clients) {
+		coro::net::close_socket(client);
+	}
+	coro::net::close_socket(listener);
+}
+
+coro::task2 idle() {
+	co_return;
+}
+
+// go() between collect_wakeups() calls queues nothing
+void collected() {
+	std::vector<coro::coroutine_handle> handles;
+	coro::coroutine_handle a = idle();
+	coro::coroutine_handle b = idle();
+	coro::coroutine_handle c = idle();
+	std::thread([&]() {
+		coro::collect_wakeups(&handles);
+		go(a);
+		coro::coroutine_handle rest[] = { b, c };
+		go(std::span<coro::coroutine_handle>(rest));
+		// already ready, not collected twice
+		go(a);
+		coro::collect_wakeups(nullptr);
+	}).join();
+	CHECK(handles.size() == 3);
+	CHECK(handles.size() == 3 && handles[0] == a && handles[1] == b && handles[2] == c);
+	for (auto handle : handles) {
+		handle.destroy();
+	}
+}
+
+coro::task2 coro_main() {
+	coro::net::socket_t listener = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	CHECK(coro::net::bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0);
+	CHECK(coro::net::listen(listener, connections) == 0);
+
+	// acceptor + sessions + clients
+	coro::wait_group wg(1 + connections * 2);
+	go(server(listener, wg));
+	for (int i = 0; i < connections; i++) {
+		go(client(i, wg));
+	}
+	co_await wg.wait();
+	coro::net::close_socket(listener);
+
+	CHECK(coro::linux_epoll::get_epoll_reactors()->reactors.size() == 4);
+
+	co_await batch();
+	// the same with the reactors polling before they block
+	coro::linux_epoll::set_epoll_busy_poll(200us);
+	CHECK(coro::linux_epoll::epoll_busy_poll() == 200us);
+	co_await batch();
+	auto before = std::chrono::steady_clock::now();
+	co_await coro::sleep_for(20ms);
+	CHECK(std::chrono::steady_clock::now() - before >= 20ms);
+	coro::linux_epoll::set_epoll_busy_poll(0us);
+
+	co_await close_while_parked();
+	co_await double_accept();
+	if (!coro::net::use_uring())
+		closed_slot();
+}
+
+int main() {
+	collected();
+	// sockets spread over several reactors even with a single worker
+	coro::linux_epoll::set_epoll_reactor_count(4);
+	coro::start_main_coroutine(coro_main());
+	return report("reactor_test");
+}
@@ -0,0 +1,145 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <channel.hpp>
+#include <task.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+Wakeup latency of a consumer coroutine while bulk coroutines keep every worker
+busy, under each schedule_policy and with the consumer at task_priority::high.
+"internal" wakeups come from a coroutine on a worker, "external" ones from a
+plain thread, like a reactor completion. The scheduler is started once per
+process, so every configuration runs in a child of its own.
+*/
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr auto duration = std::chrono::milliseconds(500);
+constexpr auto slice = std::chrono::microseconds(20);
+constexpr auto external_period = std::chrono::microseconds(250);
+constexpr int bulk_tasks = 16;
+
+struct config {
+	const char* name;
+	coro::schedule_policy policy;
+	coro::task_priority priority;
+};
+
+const config configs[] = {
+	{ "fifo", coro::schedule_policy::fifo, coro::task_priority::normal },
+	{ "lifo_slot", coro::schedule_policy::lifo_slot, coro::task_priority::normal },
+	{ "fifo+high", coro::schedule_policy::fifo, coro::task_priority::high },
+	{ "lifo_slot+high", coro::schedule_policy::lifo_slot, coro::task_priority::high },
+};
+
+std::atomic<bool> stop = false;
+std::atomic<long long> slices = 0;
+coro::task_priority consumer_priority;
+
+void spin(std::chrono::microseconds time) {
+	auto end = clock_type::now() + time;
+	while (clock_type::now() < end) {
+	}
+}
+
+coro::task2 bulk(coro::wait_group& wg) {
+	while (!stop.load(std::memory_order_relaxed)) {
+		spin(slice);
+		slices++;
+		co_await coro::yield();
+	}
+	wg.done();
+}
+
+coro::task2 producer(coro::channel<clock_type::time_point>& ch, coro::wait_group& wg) {
+	for (int i = 0; !stop.load(std::memory_order_relaxed); i++) {
+		spin(slice);
+		if (i % 5 == 0)
+			ch.try_send(clock_type::now());
+		co_await coro::yield();
+	}
+	ch.close();
+	wg.done();
+}
+
+coro::task2 consumer(coro::channel<clock_type::time_point>& ch, std::vector<double>& latencies, coro::wait_group& wg) {
+	while (true) {
+		auto sent = co_await ch.recv();
+		if (!sent)
+			break;
+		latencies.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - *sent).count());
+	}
+	wg.done();
+}
+
+void print_percentiles(std::vector<double>& latencies) {
+	if (latencies.empty()) {
+		printf(" %8s %8s %8s %8s", "-", "-", "-", "-");
+		return;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	auto at = [&](double q) { return latencies[std::min(latencies.size() - 1, (size_t)(q * latencies.size()))]; };
+	printf(" %8.1f %8.1f %8.1f %8.1f", at(0.5), at(0.99), at(0.999), latencies.back());
+}
+
+std::vector<double> internal_latencies, external_latencies;
+
+coro::task2 coro_main() {
+	coro::channel<clock_type::time_point> internal, external;
+	coro::wait_group wg(bulk_tasks + 3);
+	internal_latencies.reserve(1 << 16);
+	external_latencies.reserve(1 << 16);
+	go(consumer(internal, internal_latencies, wg), consumer_priority);
+	go(consumer(external, external_latencies, wg), consumer_priority);
+	for (int i = 0; i < bulk_tasks; i++) {
+		go(bulk(wg));
+	}
+	go(producer(internal, wg));
+
+	std::thread timer([&external]() {
+		auto end = clock_type::now() + duration;
+		while (clock_type::now() < end) {
+			std::this_thread::sleep_for(external_period);
+			external.try_send(clock_type::now());
+		}
+		stop = true;
+		external.close();
+	});
+	co_await wg.wait();
+	timer.join();
+}
+
+void run(const config& c) {
+	consumer_priority = c.priority;
+	coro::scheduler_options options;
+	options.policy = c.policy;
+	coro::start_main_coroutine(coro_main(), options);
+	printf("%-16s", c.name);
+	print_percentiles(internal_latencies);
+	printf("  ");
+	print_percentiles(external_latencies);
+	printf(" %10.1f\n", slices.load() / std::chrono::duration<double, std::milli>(duration).count());
+}
+
+int main() {
+	printf("%-16s %35s   %35s %10s\n", "", "internal wakeup (us)", "external wakeup (us)", "bulk");
+	printf("%-16s %8s %8s %8s %8s   %8s %8s %8s %8s %10s\n", "policy", "p50", "p99", "p99.9", "max", "p50", "p99", "p99.9", "max", "slices/ms");
+	fflush(stdout);
+	for (auto& c : configs) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			run(c);
+			fflush(stdout);
+			_exit(0);
+		}
+		int status = 0;
+		waitpid(pid, &status, 0);
+	}
+	return 0;
+}
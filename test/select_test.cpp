@@ -0,0 +1,150 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <select.hpp>
+#include <task.hpp>
+#include <linux_epoll.hpp>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include "check.hpp"
+
+using namespace std::literals;
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr uint16_t port = 5437;
+
+coro::task2 late_done(std::shared_ptr<coro::wait_group> wg, std::chrono::milliseconds delay) {
+	co_await coro::yield_for(delay);
+	wg->done();
+}
+
+coro::task2 late_notify(coro::condition_variable& cv, coro::mutex& mtx, bool& flag) {
+	co_await coro::sleep_for(10ms);
+	co_await mtx.lock();
+	flag = true;
+	cv.notify_one();
+	mtx.unlock();
+}
+
+coro::task2 locker(coro::mutex& mtx, std::atomic<bool>& locked) {
+	co_await mtx.lock();
+	locked = true;
+	mtx.unlock();
+}
+
+coro::task<> primitives() {
+	// already done, no suspension
+	coro::wait_group zero;
+	coro::wait_group never(1);
+	size_t fired = co_await coro::select(never.wait(), zero.wait());
+	CHECK(fired == 1);
+
+	// the wait group is done first, the timer is withdrawn
+	auto wg = std::make_shared<coro::wait_group>(1);
+	go(late_done(wg, 10ms));
+	auto start = clock_type::now();
+	fired = co_await coro::select(coro::sleep_for(10s), wg->wait());
+	CHECK(fired == 1);
+	CHECK(clock_type::now() - start < 5s);
+
+	// the deadline passes first, the waiter leaves the wait group
+	start = clock_type::now();
+	fired = co_await coro::select(never.wait(), coro::sleep_for(20ms));
+	CHECK(fired == 1);
+	CHECK(clock_type::now() - start >= 20ms);
+	CHECK(never.waiters.empty());
+	never.done();
+
+	// a condition variable, which gives the mutex back either way
+	coro::mutex mtx;
+	coro::condition_variable cv;
+	bool flag = false;
+	co_await mtx.lock();
+	go(late_notify(cv, mtx, flag));
+	while (!flag) {
+		fired = co_await coro::select(cv.wait(mtx), coro::sleep_for(5s));
+		CHECK(fired == 0);
+	}
+
+	fired = co_await coro::select(coro::sleep_for(20ms), cv.wait(mtx));
+	CHECK(fired == 0);
+	CHECK(cv.waiters.empty());
+	std::atomic<bool> locked = false;
+	go(locker(mtx, locked));
+	co_await coro::sleep_for(10ms);
+	CHECK(!locked);
+	mtx.unlock();
+	co_await coro::sleep_for(10ms);
+	CHECK(locked);
+}
+
+// The timer and the wait group race; whichever loses must never resume the coroutine later on.
+coro::task<> races() {
+	for (int i = 0; i < 2000; i++) {
+		auto wg = std::make_shared<coro::wait_group>(1);
+		go(late_done(wg, std::chrono::milliseconds(i % 2)));
+		co_await coro::select(coro::yield_for(i % 3 == 0 ? 1ms : 0ms), wg->wait());
+
+		// a second wakeup would resume this wait before the count drops
+		auto next = std::make_shared<coro::wait_group>(1);
+		go(late_done(next, 0ms));
+		co_await next->wait();
+		CHECK(next->expect_count == 0);
+		co_await wg->wait();
+	}
+}
+
+coro::task<> sockets() {
+	coro::net::socket_t listener = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	CHECK(coro::net::bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0);
+	CHECK(coro::net::listen(listener, 4) == 0);
+
+	// nobody connects yet
+	size_t fired = co_await coro::select(coro::net::accept(listener, nullptr, nullptr), coro::sleep_for(20ms));
+	CHECK(fired == 1);
+
+	coro::net::socket_t client = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	CHECK(co_await coro::net::connect(client, (sockaddr*)&addr, sizeof(addr), 1s) == 0);
+	fired = co_await coro::select(coro::sleep_for(5s), coro::net::accept(listener, nullptr, nullptr));
+	CHECK(fired == 1);
+	coro::net::socket_t server = co_await coro::net::accept(listener, nullptr, nullptr, 1s);
+	CHECK(server >= 0);
+
+	char buffer[16] = {};
+	coro::wait_group never(1);
+	fired = co_await coro::select(coro::net::recv(client, buffer, sizeof(buffer), 0), never.wait(), coro::sleep_for(20ms));
+	CHECK(fired == 2);
+
+	// readable, and the data is still there for the recv that follows
+	CHECK(co_await coro::net::send(server, "ping", 4, 0) == 4);
+	fired = co_await coro::select(never.wait(), coro::net::recv(client, buffer, sizeof(buffer), 0), coro::sleep_for(5s));
+	CHECK(fired == 1);
+	CHECK(co_await coro::net::recv(client, buffer, sizeof(buffer), 0, 1s) == 4);
+	CHECK(memcmp(buffer, "ping", 4) == 0);
+
+	// the withdrawn recv is not woken by later data
+	CHECK(co_await coro::net::send(server, "pong", 4, 0) == 4);
+	CHECK(co_await coro::net::recv(client, buffer, sizeof(buffer), 0, 1s) == 4);
+	CHECK(memcmp(buffer, "pong", 4) == 0);
+	never.done();
+
+	coro::net::close_socket(client);
+	coro::net::close_socket(server);
+	coro::net::close_socket(listener);
+}
+
+coro::task2 coro_main() {
+	co_await primitives();
+	co_await races();
+	co_await sockets();
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("select_test");
+}
@@ -0,0 +1,111 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <cstdio>
+#include <vector>
+#include "check.hpp"
+
+using namespace std::literals;
+
+std::atomic<int> inside = 0;
+std::atomic<int> max_inside = 0;
+
+coro::task2 worker(coro::semaphore& sem, coro::wait_group& wg) {
+	for (int i = 0; i < 500; i++) {
+		bool acquired = co_await sem.acquire();
+		CHECK(acquired);
+		int n = ++inside;
+		int max = max_inside.load();
+		while (n > max && !max_inside.compare_exchange_weak(max, n)) {
+		}
+		if (i % 3 == 0)
+			co_await coro::yield();
+		--inside;
+		sem.release();
+	}
+	wg.done();
+}
+
+coro::task<> limit() {
+	coro::semaphore sem(3);
+	coro::wait_group wg(20);
+	for (int i = 0; i < 20; i++) {
+		go(worker(sem, wg));
+	}
+	co_await wg.wait();
+	CHECK(max_inside.load() <= 3);
+	CHECK(max_inside.load() > 1);
+	CHECK(sem.available() == 3);
+}
+
+coro::task2 taker(coro::semaphore& sem, size_t n, int id, std::vector<int>& order, coro::wait_group& started, coro::wait_group& wg) {
+	started.done();
+	bool acquired = co_await sem.acquire(n);
+	CHECK(acquired);
+	order.push_back(id);
+	wg.done();
+}
+
+// acquire(5) queued first is served before acquire(1) though one would fit earlier
+coro::task<> fifo() {
+	coro::semaphore sem(0);
+	std::vector<int> order;
+	coro::wait_group wg(2);
+	coro::wait_group first(1), second(1);
+	go(taker(sem, 5, 0, order, first, wg));
+	co_await first.wait();
+	co_await coro::sleep_for(5ms);
+	go(taker(sem, 1, 1, order, second, wg));
+	co_await second.wait();
+	co_await coro::sleep_for(5ms);
+	sem.release(2);
+	co_await coro::sleep_for(5ms);
+	CHECK(order.empty());
+	CHECK(!sem.try_acquire(1));
+	sem.release(3);
+	co_await coro::sleep_for(5ms);
+	CHECK(order.size() == 1 && order[0] == 0);
+	sem.release(1);
+	co_await wg.wait();
+	CHECK(order.size() == 2 && order[1] == 1);
+	CHECK(sem.available() == 0);
+}
+
+coro::task2 cancelled_taker(coro::semaphore& sem, coro::wait_group& wg) {
+	bool acquired = co_await sem.acquire(10);
+	CHECK(!acquired);
+	wg.done();
+}
+
+// cancelling the head waiter lets the one behind it through
+coro::task<> cancel() {
+	coro::semaphore sem(2);
+	coro::cancellation_source source;
+	std::vector<int> order;
+	coro::wait_group wg(2), started(1);
+	go(cancelled_taker(sem, wg), source.token());
+	co_await coro::sleep_for(5ms);
+	go(taker(sem, 2, 1, order, started, wg));
+	co_await started.wait();
+	co_await coro::sleep_for(5ms);
+	CHECK(order.empty());
+	source.cancel();
+	co_await wg.wait();
+	CHECK(order.size() == 1);
+	CHECK(sem.available() == 0);
+	sem.release(2);
+	CHECK(sem.try_acquire(2));
+	CHECK(!sem.try_acquire());
+}
+
+coro::task2 coro_main() {
+	co_await limit();
+	co_await fifo();
+	co_await cancel();
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("semaphore_test");
+}
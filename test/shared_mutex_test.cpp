@@ -0,0 +1,174 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <cstdio>
+#include <string>
+#include "check.hpp"
+
+using namespace std::literals;
+
+constexpr int readers = 32;
+constexpr int writers = 8;
+constexpr int rounds = 1000;
+
+std::atomic<int> active_readers = 0;
+std::atomic<int> active_writers = 0;
+std::atomic<int> max_readers = 0;
+
+coro::task2 reader(coro::shared_mutex& mtx, coro::wait_group& wg) {
+	for (int i = 0; i < rounds; i++) {
+		bool locked = co_await mtx.lock_shared();
+		CHECK(locked);
+		int n = ++active_readers;
+		int max = max_readers.load();
+		while (n > max && !max_readers.compare_exchange_weak(max, n)) {
+		}
+		CHECK(active_writers.load() == 0);
+		if (i % 5 == 0)
+			co_await coro::yield();
+		--active_readers;
+		mtx.unlock_shared();
+	}
+	wg.done();
+}
+
+coro::task2 writer(coro::shared_mutex& mtx, long long& value, coro::wait_group& wg) {
+	for (int i = 0; i < rounds; i++) {
+		bool locked = co_await mtx.lock();
+		CHECK(locked);
+		CHECK(++active_writers == 1);
+		CHECK(active_readers.load() == 0);
+		long long v = value;
+		if (i % 7 == 0)
+			co_await coro::yield();
+		value = v + 1;
+		--active_writers;
+		mtx.unlock();
+	}
+	wg.done();
+}
+
+coro::task<> exclusion(coro::shared_mutex_mode mode) {
+	coro::shared_mutex mtx(mode);
+	long long value = 0;
+	coro::wait_group wg(readers + writers);
+	max_readers = 0;
+	for (int i = 0; i < readers + writers; i++) {
+		if (i % 5 == 0)
+			go(writer(mtx, value, wg));
+		else
+			go(reader(mtx, wg));
+	}
+	co_await wg.wait();
+	CHECK(value == (long long)writers * rounds);
+	// readers do share the lock
+	CHECK(max_readers.load() > 1);
+	CHECK(mtx.try_lock());
+	CHECK(!mtx.try_lock_shared());
+	mtx.unlock();
+	CHECK(mtx.try_lock_shared());
+	CHECK(mtx.try_lock_shared());
+	CHECK(!mtx.try_lock());
+	mtx.unlock_shared();
+	mtx.unlock_shared();
+}
+
+coro::spin_lock order_lock;
+
+coro::task2 queued(coro::shared_mutex& mtx, bool shared, char id, std::string& order, coro::wait_group& started, coro::wait_group& wg) {
+	started.done();
+	if (shared) {
+		co_await mtx.lock_shared();
+		{
+			// readers append side by side
+			std::lock_guard<coro::spin_lock> lg(order_lock);
+			order += id;
+		}
+		co_await coro::sleep_for(5ms);
+		mtx.unlock_shared();
+	}
+	else {
+		co_await mtx.lock();
+		order += id;
+		co_await coro::sleep_for(5ms);
+		mtx.unlock();
+	}
+	wg.done();
+}
+
+// A writer holds the lock while readers a-d, writer W and readers e-h queue up.
+coro::task<std::string> admission(coro::shared_mutex_mode mode) {
+	coro::shared_mutex mtx(mode);
+	std::string order;
+	coro::wait_group wg(9);
+	co_await mtx.lock();
+	const char* ids = "abcdWefgh";
+	for (int i = 0; i < 9; i++) {
+		coro::wait_group started(1);
+		go(queued(mtx, ids[i] != 'W', ids[i], order, started, wg));
+		co_await started.wait();
+		co_await coro::sleep_for(2ms);
+	}
+	mtx.unlock();
+	co_await wg.wait();
+	co_return order;
+}
+
+coro::task<> order() {
+	// the whole reader batch goes in at once, then W
+	std::string batched = co_await admission(coro::shared_mutex_mode::batched);
+	CHECK(batched.size() == 9);
+	CHECK(batched.find('W') == 8);
+	// W goes first, then every reader
+	std::string preferring = co_await admission(coro::shared_mutex_mode::writer_preferring);
+	CHECK(preferring.size() == 9);
+	CHECK(preferring.find('W') == 0);
+}
+
+coro::task2 cancelled_writer(coro::shared_mutex& mtx, coro::wait_group& wg) {
+	bool locked = co_await mtx.lock();
+	CHECK(!locked);
+	wg.done();
+}
+
+coro::task2 blocked_reader(coro::shared_mutex& mtx, std::atomic<bool>& got, coro::wait_group& wg) {
+	bool locked = co_await mtx.lock_shared();
+	CHECK(locked);
+	got = true;
+	mtx.unlock_shared();
+	wg.done();
+}
+
+// a cancelled writer lets in the readers that queued behind it
+coro::task<> cancel() {
+	coro::shared_mutex mtx;
+	coro::cancellation_source source;
+	coro::wait_group wg(2);
+	std::atomic<bool> got = false;
+	CHECK(mtx.try_lock_shared());
+	go(cancelled_writer(mtx, wg), source.token());
+	co_await coro::sleep_for(5ms);
+	CHECK(!mtx.try_lock_shared());
+	go(blocked_reader(mtx, got, wg));
+	co_await coro::sleep_for(5ms);
+	CHECK(!got);
+	source.cancel();
+	co_await wg.wait();
+	CHECK(got);
+	mtx.unlock_shared();
+	CHECK(mtx.try_lock());
+	mtx.unlock();
+}
+
+coro::task2 coro_main() {
+	co_await exclusion(coro::shared_mutex_mode::batched);
+	co_await exclusion(coro::shared_mutex_mode::writer_preferring);
+	co_await order();
+	co_await cancel();
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("shared_mutex_test");
+}
@@ -0,0 +1,99 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <stdexcept>
+#include <cstdio>
+#include "check.hpp"
+
+coro::task<int> add(int a, int b) {
+	co_return a + b;
+}
+
+coro::task<int> fib(int n) {
+	if (n < 2)
+		co_return n;
+	int a = co_await fib(n - 1);
+	int b = co_await fib(n - 2);
+	co_return a + b;
+}
+
+coro::task<> thrower() {
+	throw std::runtime_error("boom");
+	co_return;
+}
+
+coro::task<int> locked_increment(coro::mutex& mtx, int& value) {
+	co_await mtx.lock();
+	co_await coro::yield();
+	int v = ++value;
+	mtx.unlock();
+	co_return v;
+}
+
+coro::task2 incrementer(coro::mutex& mtx, int& value, coro::wait_group& wg) {
+	for (int i = 0; i < 100; i++) {
+		co_await locked_increment(mtx, value);
+	}
+	wg.done();
+}
+
+// a freed frame serves the next one of its size class on the same thread
+void frame_reuse() {
+	void* a = coro::allocate_frame(100);
+	coro::deallocate_frame(a, 100);
+	void* b = coro::allocate_frame(120);
+	CHECK(b == a);
+	// a different class does not take it
+	coro::deallocate_frame(b, 120);
+	void* c = coro::allocate_frame(200);
+	CHECK(c != a);
+	void* d = coro::allocate_frame(100);
+	CHECK(d == a);
+	coro::deallocate_frame(c, 200);
+	coro::deallocate_frame(d, 100);
+}
+
+coro::task2 coro_main() {
+	frame_reuse();
+	CHECK(co_await add(1, 2) == 3);
+	CHECK(co_await fib(15) == 610);
+
+	// symmetric transfer: a long loop of awaited tasks must not grow the stack
+	long long sum = 0;
+	for (int i = 0; i < 1000000; i++) {
+		sum += co_await add(i, 1);
+	}
+	CHECK(sum == 500000500000LL);
+
+	bool caught = false;
+	try {
+		co_await thrower();
+	}
+	catch (const std::runtime_error&) {
+		caught = true;
+	}
+	CHECK(caught);
+
+	// awaiters parked from inside a child task resume the child
+	constexpr int workers = 8;
+	coro::mutex mtx;
+	coro::wait_group wg(workers);
+	int value = 0;
+	for (int i = 0; i < workers; i++) {
+		go(incrementer(mtx, value, wg));
+	}
+	co_await wg.wait();
+	CHECK(value == workers * 100);
+
+#ifdef CORO_FRAME_POOL_STATS
+	// every add() frame after the first one comes from the pool
+	auto stats = coro::frame_pool_snapshot();
+	printf("frame pool: %llu allocations, hit rate %.3f\n", (unsigned long long)stats.allocations, stats.hit_rate());
+	CHECK(stats.hit_rate() > 0.9);
+#endif
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("task_test");
+}
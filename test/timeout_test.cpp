@@ -0,0 +1,79 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <linux_epoll.hpp>
+#include <cstdio>
+#include <cstring>
+#include "check.hpp"
+
+using namespace std::literals;
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr uint16_t port = 5435;
+
+coro::task2 late_reply(int fd, coro::wait_group& wg) {
+	co_await coro::sleep_for(20ms);
+	int sent = co_await coro::net::send(fd, "pong", 4, 0);
+	CHECK(sent == 4);
+	wg.done();
+}
+
+coro::task2 coro_main() {
+	coro::net::socket_t listener = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	CHECK(coro::net::bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0);
+	CHECK(coro::net::listen(listener, 4) == 0);
+
+	// nobody connects
+	auto start = clock_type::now();
+	CHECK(co_await coro::net::accept(listener, nullptr, nullptr, 30ms) == -1);
+	CHECK(errno == ETIMEDOUT);
+	CHECK(clock_type::now() - start >= 30ms);
+
+	coro::net::socket_t client = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	CHECK(co_await coro::net::connect(client, (sockaddr*)&addr, sizeof(addr), 1s) == 0);
+	coro::net::socket_t server = co_await coro::net::accept(listener, nullptr, nullptr, 1s);
+	CHECK(server >= 0);
+
+	// nothing sent
+	char buffer[16] = {};
+	start = clock_type::now();
+	CHECK(co_await coro::net::recv(client, buffer, sizeof(buffer), 0, 50ms) == -1);
+	CHECK(errno == ETIMEDOUT);
+	auto elapsed = clock_type::now() - start;
+	CHECK(elapsed >= 50ms);
+	CHECK(elapsed < 1s);
+
+	// a reply within the deadline, the socket still works after the timeout
+	coro::wait_group wg(1);
+	go(late_reply(server, wg));
+	CHECK(co_await coro::net::recv(client, buffer, sizeof(buffer), 0, clock_type::now() + 1s) == 4);
+	CHECK(memcmp(buffer, "pong", 4) == 0);
+	co_await wg.wait();
+
+	// a deadline in the past still takes data that is already there
+	CHECK(co_await coro::net::send(server, "ping", 4, 0) == 4);
+	co_await coro::sleep_for(5ms);
+	CHECK(co_await coro::net::recv(client, buffer, sizeof(buffer), 0, -1ms) == 4);
+	CHECK(co_await coro::net::recv(client, buffer, sizeof(buffer), 0, -1ms) == -1);
+	CHECK(errno == ETIMEDOUT);
+
+	// many short timeouts in a row leave nothing behind in the registration
+	for (int i = 0; i < 100; i++) {
+		CHECK(co_await coro::net::recv(client, buffer, sizeof(buffer), 0, 1ms) == -1);
+	}
+	CHECK(co_await coro::net::send(server, "done", 4, 0) == 4);
+	CHECK(co_await coro::net::recv(client, buffer, sizeof(buffer), 0, 1s) == 4);
+
+	coro::net::close_socket(client);
+	coro::net::close_socket(server);
+	coro::net::close_socket(listener);
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("timeout_test");
+}
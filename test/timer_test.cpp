@@ -0,0 +1,99 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <timer.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include "check.hpp"
+
+using namespace std::literals;
+
+using clock_type = std::chrono::steady_clock;
+
+coro::task2 sleeper(std::chrono::milliseconds d, std::atomic<int>& early, coro::wait_group& wg) {
+	auto start = clock_type::now();
+	co_await coro::sleep_for(d);
+	if (clock_type::now() - start < d)
+		early++;
+	wg.done();
+}
+
+void wheel_cancel() {
+	struct counted : coro::details::timer_node {
+		int fired = 0;
+	};
+	coro::details::timer_wheel wheel;
+	counted a, b;
+	for (auto* n : { &a, &b }) {
+		n->deadline = coro::details::now_tick();
+		n->routine = [](coro::details::timer_node* self) { static_cast<counted*>(self)->fired++; };
+		wheel.add(n);
+	}
+	CHECK(coro::details::cancel_timer(&a));
+	CHECK(!coro::details::cancel_timer(&a));
+
+	std::this_thread::sleep_for(5ms);
+	wheel.expire();
+	CHECK(a.fired == 0);
+	CHECK(b.fired == 1);
+	CHECK(!coro::details::cancel_timer(&b));
+
+	// due right after level 0 wraps around
+	a.deadline = (wheel.current | coro::details::timer_wheel::mask) + 1;
+	wheel.add(&a);
+	CHECK(wheel.timeout() >= 0);
+	CHECK(coro::details::cancel_timer(&a));
+}
+
+// a driver with only far timers sleeps until they get close, not to every wrap of level 0
+void wheel_sleep() {
+	coro::details::timer_wheel wheel;
+	coro::details::timer_node far, farther;
+	far.deadline = coro::details::now_tick() + 10000;
+	farther.deadline = coro::details::now_tick() + 100000;
+	for (auto* n : { &far, &farther }) {
+		n->routine = [](coro::details::timer_node*) {};
+	}
+	wheel.add(&farther);
+	int timeout = wheel.timeout();
+	CHECK(timeout > 30000 && timeout <= 100000);
+	wheel.add(&far);
+	timeout = wheel.timeout();
+	CHECK(timeout > 9000 && timeout <= 10000);
+	CHECK(coro::details::cancel_timer(&far));
+	CHECK(coro::details::cancel_timer(&farther));
+	CHECK(wheel.timeout() == -1);
+}
+
+coro::task2 coro_main() {
+	auto start = clock_type::now();
+	co_await coro::sleep_for(50ms);
+	auto elapsed = clock_type::now() - start;
+	CHECK(elapsed >= 50ms);
+	CHECK(elapsed < 1s);
+
+	start = clock_type::now();
+	co_await coro::sleep_until(start + 20ms);
+	CHECK(clock_type::now() >= start + 20ms);
+
+	// already due: sleep_for does not suspend, yield_for always does
+	co_await coro::sleep_for(-1ms);
+	co_await coro::yield_for(0ms);
+
+	// far timers go through the upper levels of the wheel before they fire
+	constexpr int sleepers = 10000;
+	std::atomic<int> early = 0;
+	coro::wait_group wg(sleepers);
+	for (int i = 0; i < sleepers; i++) {
+		go(sleeper(std::chrono::milliseconds(rand() % 1200), early, wg));
+	}
+	co_await wg.wait();
+	CHECK(early == 0);
+}
+
+int main() {
+	wheel_cancel();
+	wheel_sleep();
+	printf("timer node: %zu bytes, sleep awaiter: %zu bytes\n", sizeof(coro::details::timer_node), sizeof(coro::sleep_awaiter));
+	coro::start_main_coroutine(coro_main());
+	return report("timer_test");
+}
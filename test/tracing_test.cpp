@@ -0,0 +1,140 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <tracing.hpp>
+#include <cstdio>
+#include <string>
+#include "check.hpp"
+
+using namespace std::literals;
+
+const char* path = "tracing_test.json";
+const char* odd_name = "say \"hi\"\\\t";
+// exported after the first session and after the last two
+std::string first;
+std::string last;
+// spawn, ready, resume and done of each, on the one worker
+const int tasks = (int)(coro::tracing::buffer_capacity * 3 / 4 / 4);
+
+coro::task2 holder(coro::semaphore& sem, coro::wait_group& wg) {
+	co_await sem.acquire();
+	sem.release();
+	wg.done();
+}
+
+coro::task2 child(coro::mutex& mtx, coro::wait_group& wg) {
+	co_await mtx.lock();
+	co_await coro::sleep_for(1ms);
+	mtx.unlock();
+	wg.done();
+}
+
+coro::task2 parent(coro::mutex& mtx, coro::wait_group& wg) {
+	coro::wait_group children(4);
+	for (int i = 0; i < 4; i++) {
+		go(child(mtx, children));
+	}
+	co_await children.wait();
+	wg.done();
+}
+
+coro::task2 nothing(coro::wait_group& wg) {
+	wg.done();
+	co_return;
+}
+
+// on an executor whose name needs escaping
+coro::task<> session() {
+	coro::tracing::start();
+	co_await coro::switch_to(coro::find_executor(odd_name));
+	coro::wait_group wg(tasks);
+	for (int i = 0; i < tasks; i++) {
+		go(nothing(wg));
+	}
+	co_await wg.wait();
+	co_await coro::switch_to(coro::default_executor());
+	coro::tracing::stop();
+}
+
+int count(const std::string& text, const std::string& what) {
+	int n = 0;
+	for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1))
+		n++;
+	return n;
+}
+
+std::string export_trace() {
+	std::string text;
+	CHECK(coro::tracing::write_chrome_trace(path));
+	FILE* f = fopen(path, "r");
+	CHECK(f != nullptr);
+	if (f != nullptr) {
+		char buffer[4096];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			text.append(buffer, n);
+		fclose(f);
+	}
+	remove(path);
+	return text;
+}
+
+coro::task2 coro_main() {
+	// before start(), left out of the trace
+	coro::semaphore sem(0);
+	coro::wait_group before(1);
+	go(holder(sem, before));
+	co_await coro::sleep_for(5ms);
+	sem.release();
+	co_await before.wait();
+
+	coro::tracing::start();
+	coro::mutex mtx;
+	coro::wait_group wg(2);
+	go(parent(mtx, wg));
+	go(parent(mtx, wg));
+	co_await wg.wait();
+	coro::tracing::stop();
+	first = export_trace();
+	CHECK(coro::tracing::dropped() == 0);
+
+	// together more events than a buffer holds, each session alone fits
+	coro::executor_options options;
+	options.name = odd_name;
+	coro::make_executor(std::move(options));
+	co_await session();
+	co_await session();
+	CHECK(coro::tracing::dropped() == 0);
+	last = export_trace();
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	CHECK(!coro::tracing::write_chrome_trace("/nonexistent/dir/trace.json"));
+
+	std::string& text = first;
+
+	CHECK(text.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0);
+	CHECK(text.find("\n]}") != std::string::npos);
+	CHECK(text.find("\"thread_name\"") != std::string::npos);
+	CHECK(text.find("default worker 0") != std::string::npos);
+	// 2 parents and 8 children spawned after start(), each with an arrow to its first run
+	CHECK(count(text, "\"ph\":\"s\"") == 10);
+	CHECK(count(text, "\"ph\":\"f\"") == 10);
+	// every one of them ran to the end
+	CHECK(count(text, "\"end\":\"done\"") == 10);
+	CHECK(text.find("\"name\":\"mutex\"") != std::string::npos);
+	CHECK(text.find("\"name\":\"sleep\"") != std::string::npos);
+	CHECK(text.find("\"name\":\"wait_group\"") != std::string::npos);
+	CHECK(text.find("\"name\":\"queued\"") != std::string::npos);
+	// slices open and close in pairs
+	CHECK(count(text, "\"ph\":\"b\"") >= count(text, "\"ph\":\"e\""));
+	CHECK(text.find("semaphore") == std::string::npos);
+
+	CHECK(last.find("\"name\":\"say \\\"hi\\\"\\\\\\u0009 worker 0\"") != std::string::npos);
+	CHECK(count(last, "\"end\":\"done\"") == tasks);
+	CHECK(last.find("\"name\":\"mutex\"") == std::string::npos);
+
+	return report("tracing_test");
+}
@@ -0,0 +1,171 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <linux_epoll.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include "check.hpp"
+
+constexpr uint16_t port = 5433;
+
+coro::task2 file_io(coro::wait_group& wg) {
+	char path[] = "/tmp/libcoro_uring_XXXXXX";
+	int fd = mkstemp(path);
+	unlink(path);
+
+	const char text[] = "hello io_uring";
+	int written = co_await coro::linux_uring::write(fd, text, sizeof(text), 0);
+	CHECK(written == (int)sizeof(text));
+
+	char buffer[64] = {};
+	int got = co_await coro::linux_uring::read(fd, buffer, sizeof(buffer), 0);
+	CHECK(got == (int)sizeof(text));
+	CHECK(strcmp(buffer, text) == 0);
+
+	// registered buffers
+	static char fixed[4096];
+	iovec iov = { fixed, sizeof(fixed) };
+	CHECK(coro::linux_uring::register_buffers(&iov, 1) == 0);
+	memset(fixed, 0, sizeof(fixed));
+	got = co_await coro::linux_uring::read_fixed(fd, fixed, sizeof(text), 0, 0);
+	CHECK(got == (int)sizeof(text));
+	CHECK(strcmp(fixed, text) == 0);
+
+	int closed = co_await coro::linux_uring::close(fd);
+	CHECK(closed == 0);
+	wg.done();
+}
+
+coro::task2 null_write(int fd, coro::wait_group& wg) {
+	char c = 'x';
+	int n = co_await coro::linux_uring::write(fd, &c, 1);
+	CHECK(n == 1);
+	wg.done();
+}
+
+// more operations in flight than the submission queue holds
+coro::task2 flood(coro::wait_group& done) {
+	int fd = open("/dev/null", O_WRONLY);
+	CHECK(fd >= 0);
+	constexpr int count = coro::linux_uring::uring_awaiter::ring_entries * 4;
+	coro::wait_group wg(count);
+	for (int i = 0; i < count; i++) {
+		go(null_write(fd, wg));
+	}
+	co_await wg.wait();
+	close(fd);
+	done.done();
+}
+
+coro::task2 echo_session(int fd, coro::linux_uring::buffer_ring& buffers, coro::wait_group& wg) {
+	coro::linux_uring::multishot_receiver receiver(fd, buffers);
+	while (true) {
+		auto chunk = co_await receiver.recv();
+		if (chunk.len <= 0)
+			break;
+		co_await coro::net::send(fd, chunk.data, chunk.len, 0);
+		buffers.recycle(chunk.buffer_id);
+	}
+	coro::net::close_socket(fd);
+	wg.done();
+}
+
+coro::task2 server(int listener, coro::wait_group& wg) {
+	static coro::linux_uring::buffer_ring buffers(1, 16, 256);
+	CHECK(buffers.valid());
+
+	coro::linux_uring::multishot_acceptor acceptor(listener);
+	for (int i = 0; i < 2; i++) {
+		int fd = co_await acceptor.accept();
+		CHECK(fd >= 0);
+		if (fd < 0)
+			break;
+		go(echo_session(fd, buffers, wg));
+	}
+	wg.done();
+}
+
+coro::task2 client(int id, coro::wait_group& wg) {
+	coro::net::socket_t sock = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	int connected = co_await coro::net::connect(sock, (sockaddr*)&addr, sizeof(addr));
+	CHECK(connected == 0);
+
+	for (int i = 0; i < 100; i++) {
+		char message[32];
+		int len = snprintf(message, sizeof(message), "client %d message %d", id, i);
+		int sent = co_await coro::net::send(sock, message, len, 0);
+		CHECK(sent == len);
+
+		char reply[32] = {};
+		int received = co_await coro::net::recv(sock, reply, len, MSG_WAITALL);
+		CHECK(received == len);
+		CHECK(memcmp(message, reply, len) == 0);
+	}
+	coro::net::close_socket(sock);
+	wg.done();
+}
+
+coro::task2 plain_echo(int listener, coro::wait_group& wg) {
+	for (int i = 0; i < 2; i++) {
+		int fd = co_await coro::net::accept(listener, nullptr, nullptr);
+		CHECK(fd >= 0);
+		go([](int fd, coro::wait_group& wg) -> coro::task2 {
+			char buffer[256];
+			while (true) {
+				int n = co_await coro::net::recv(fd, buffer, sizeof(buffer), 0);
+				if (n <= 0)
+					break;
+				co_await coro::net::send(fd, buffer, n, 0);
+			}
+			coro::net::close_socket(fd);
+			wg.done();
+		}(fd, wg));
+	}
+	wg.done();
+}
+
+coro::task2 coro_main() {
+	bool uring = coro::net::use_uring();
+	printf("backend: %s\n", uring ? "io_uring" : "epoll");
+
+	coro::wait_group wg(0);
+	if (uring) {
+		wg.add(1);
+		go(file_io(wg));
+		co_await wg.wait();
+		wg.add(1);
+		go(flood(wg));
+		co_await wg.wait();
+		// its storage is freed by the completion of the removal
+		{
+			coro::linux_uring::buffer_ring temporary(2, 4, 64);
+			CHECK(temporary.valid());
+		}
+	}
+
+	coro::net::socket_t listener = coro::net::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	CHECK(coro::net::bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0);
+	CHECK(coro::net::listen(listener, 16) == 0);
+
+	// acceptor + 2 sessions + 2 clients
+	wg.add(5);
+	go(uring ? server(listener, wg) : plain_echo(listener, wg));
+	go(client(0, wg));
+	go(client(1, wg));
+	co_await wg.wait();
+	coro::net::close_socket(listener);
+}
+
+int main() {
+	coro::start_main_coroutine(coro_main());
+	return report("uring_test");
+}
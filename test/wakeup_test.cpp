@@ -0,0 +1,193 @@
+#include <scheduler.hpp>
+#include <awaiters.hpp>
+#include <channel.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+
+using namespace std::literals;
+
+constexpr int waiters = 10000;
+
+coro::task2 wg_waiter(coro::wait_group& gate, std::atomic<int>& woken, coro::wait_group& wg) {
+	co_await gate.wait();
+	woken++;
+	wg.done();
+}
+
+// done() wakes every waiter, more than one batch of them
+coro::task<> wait_group_wakeup() {
+	coro::wait_group gate(1);
+	coro::wait_group wg(waiters);
+	std::atomic<int> woken = 0;
+	for (int i = 0; i < waiters; i++) {
+		go(wg_waiter(gate, woken, wg));
+	}
+	co_await coro::sleep_for(10ms);
+	CHECK(woken.load() == 0);
+	gate.done();
+	co_await wg.wait();
+	CHECK(woken.load() == waiters);
+	CHECK(gate.waiters.empty());
+}
+
+std::atomic<int> holders = 0;
+
+coro::task2 cv_waiter(coro::condition_variable& cv, coro::mutex& mtx, bool& flag, int& woken, coro::wait_group& started, coro::wait_group& wg) {
+	co_await mtx.lock();
+	started.done();
+	while (!flag) {
+		co_await cv.wait(mtx);
+	}
+	// the waiters morphed onto the mutex get it one at a time
+	CHECK(++holders == 1);
+	woken++;
+	if (woken % 16 == 0)
+		co_await coro::yield();
+	holders--;
+	mtx.unlock();
+	wg.done();
+}
+
+coro::task<> notify_all(coro::mutex_mode mode) {
+	constexpr int count = 1000;
+	coro::mutex mtx(mode);
+	coro::condition_variable cv;
+	coro::wait_group started(count), wg(count);
+	bool flag = false;
+	int woken = 0;
+	for (int i = 0; i < count; i++) {
+		go(cv_waiter(cv, mtx, flag, woken, started, wg));
+	}
+	co_await started.wait();
+	co_await mtx.lock();
+	flag = true;
+	cv.notify_all();
+	CHECK(cv.waiters.empty());
+	// all of them queue for the mutex, which this task still holds
+	co_await coro::sleep_for(5ms);
+	CHECK(woken == 0);
+	mtx.unlock();
+	co_await wg.wait();
+	CHECK(woken == count);
+	CHECK(mtx.try_lock());
+	mtx.unlock();
+}
+
+// the lock is free when notify_all() runs, the first waiter takes it
+coro::task<> notify_all_unlocked() {
+	coro::mutex mtx;
+	coro::condition_variable cv;
+	coro::wait_group started(8), wg(8);
+	bool flag = false;
+	int woken = 0;
+	for (int i = 0; i < 8; i++) {
+		go(cv_waiter(cv, mtx, flag, woken, started, wg));
+	}
+	co_await started.wait();
+	co_await mtx.lock();
+	flag = true;
+	mtx.unlock();
+	cv.notify_all();
+	co_await wg.wait();
+	CHECK(woken == 8);
+}
+
+coro::task2 receiver(coro::channel<int>& ch, std::atomic<int>& closed, coro::wait_group& wg) {
+	auto value = co_await ch.recv();
+	if (!value)
+		closed++;
+	wg.done();
+}
+
+coro::task<> channel_close() {
+	coro::channel<int> ch;
+	std::atomic<int> closed = 0;
+	coro::wait_group wg(500);
+	for (int i = 0; i < 500; i++) {
+		go(receiver(ch, closed, wg));
+	}
+	co_await coro::sleep_for(5ms);
+	ch.close();
+	co_await wg.wait();
+	CHECK(closed.load() == 500);
+}
+
+coro::task2 counted(std::atomic<int>& runs, coro::wait_group& wg) {
+	runs++;
+	wg.done();
+	co_return;
+}
+
+// go(span) starts created tasks and skips those scheduled already
+coro::task<> go_span() {
+	std::atomic<int> runs = 0;
+	coro::wait_group wg(100);
+	std::vector<coro::coroutine_handle> handles;
+	for (int i = 0; i < 100; i++) {
+		coro::task2 t = counted(runs, wg);
+		handles.push_back(t);
+	}
+	go(handles[0]);
+	coro::go(std::span<coro::coroutine_handle>(handles));
+	co_await wg.wait();
+	co_await coro::sleep_for(5ms);
+	CHECK(runs.load() == 100);
+}
+
+coro::task2 hog(std::atomic<size_t>& home, std::atomic<bool>& woken, bool& seen, coro::wait_group& wg) {
+	home = coro::current_worker_index();
+	auto until = std::chrono::steady_clock::now() + 2s;
+	while (!woken.load() && std::chrono::steady_clock::now() < until) {
+	}
+	seen = woken.load();
+	wg.done();
+	co_return;
+}
+
+coro::task2 setter(std::atomic<bool>& woken, coro::wait_group& wg) {
+	woken = true;
+	wg.done();
+	co_return;
+}
+
+// a task queued to the inbox of a busy worker does not wait for it
+coro::task<> busy_home() {
+	std::atomic<size_t> home = SIZE_MAX;
+	std::atomic<bool> woken = false;
+	bool seen = false;
+	coro::wait_group wg(2);
+	go(hog(home, woken, seen, wg));
+	while (home.load() == SIZE_MAX) {
+		co_await coro::sleep_for(1ms);
+	}
+	// like a reactor paired with the worker of hog
+	coro::coroutine_handle handle = setter(woken, wg);
+	std::thread([&]() {
+		coro::set_home_worker(home.load());
+		go(handle);
+	}).join();
+	co_await wg.wait();
+	CHECK(seen);
+}
+
+coro::task2 coro_main() {
+	co_await wait_group_wakeup();
+	co_await notify_all(coro::mutex_mode::handoff);
+	co_await notify_all(coro::mutex_mode::barging);
+	co_await notify_all_unlocked();
+	co_await channel_close();
+	co_await go_span();
+	co_await busy_home();
+}
+
+int main() {
+	// busy_home() needs a second worker
+	coro::scheduler_options options;
+	options.worker_count = 2;
+	coro::start_main_coroutine(coro_main(), options);
+	return report("wakeup_test");
+}